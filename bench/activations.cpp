@@ -0,0 +1,108 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Accuracy and speed of the nn::simd kernels against the std:: functions
+// the activations used before, for every SIMD level this CPU supports.
+
+using nn::simd::Level;
+
+static const char* level_name(Level l) {
+  switch (l) {
+    case Level::AVX512:
+      return "avx512";
+    case Level::AVX2:
+      return "avx2";
+    case Level::Generic:
+      break;
+  }
+  return "generic";
+}
+
+static int64_t ordered(float x) {
+  int32_t i;
+  std::memcpy(&i, &x, sizeof(i));
+  return i < 0 ? int64_t(INT32_MIN) - i : i;
+}
+
+static int64_t ulp_distance(float a, float b) {
+  int64_t d = ordered(a) - ordered(b);
+  return d < 0 ? -d : d;
+}
+
+template <typename F>
+static double ns_per_element(std::vector<float>& buf, F&& f) {
+  using clock = std::chrono::steady_clock;
+  size_t reps = 0;
+  auto start = clock::now();
+  double elapsed = 0.0;
+  do {
+    f(buf.data(), buf.size());
+    ++reps;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < 0.1);
+  return elapsed / reps / buf.size() * 1e9;
+}
+
+struct Case {
+  const char* name;
+  void (*fast)(float*, size_t);
+  float (*exact)(float);
+  float lo, hi;
+};
+
+int main() {
+  std::vector<Case> cases = {
+      {"exp", nn::simd::exp, [](float x) { return std::exp(x); }, -87.0f,
+       88.0f},
+      {"sigmoid", nn::simd::sigmoid, nn::Sigmoid, -30.0f, 30.0f},
+      {"tanh", nn::simd::tanh, [](float x) { return std::tanh(x); }, -10.0f,
+       10.0f},
+      {"sin", nn::simd::sin, [](float x) { return std::sin(x); }, -100.0f,
+       100.0f},
+      {"cos", nn::simd::cos, [](float x) { return std::cos(x); }, -100.0f,
+       100.0f},
+  };
+
+  const size_t n = 1 << 20;
+  Level best = nn::simd::detect_level();
+  std::printf("%-8s %-8s %10s %12s %10s %10s\n", "func", "level", "max ulp",
+              "max abs err", "ns/elem", "std ns");
+  for (const Case& c : cases) {
+    std::vector<float> x(n), want(n), got(n);
+    for (size_t i = 0; i < n; ++i) {
+      x[i] = c.lo + (c.hi - c.lo) * float(i) / float(n - 1);
+      want[i] = c.exact(x[i]);
+    }
+    std::vector<float> buf = x;
+    double std_ns = ns_per_element(buf, [&](float* p, size_t m) {
+      for (size_t i = 0; i < m; ++i) {
+        p[i] = c.exact(p[i]);
+      }
+    });
+
+    for (Level l : {Level::Generic, Level::AVX2, Level::AVX512}) {
+      if (l > best) {
+        continue;
+      }
+      nn::simd::set_level(l);
+      got = x;
+      c.fast(got.data(), n);
+      int64_t max_ulp = 0;
+      float max_abs = 0.0f;
+      for (size_t i = 0; i < n; ++i) {
+        max_ulp = std::max(max_ulp, ulp_distance(got[i], want[i]));
+        max_abs = std::max(max_abs, std::abs(got[i] - want[i]));
+      }
+      buf = x;
+      double ns = ns_per_element(buf, c.fast);
+      std::printf("%-8s %-8s %10lld %12.3e %10.3f %10.3f\n", c.name,
+                  level_name(l), static_cast<long long>(max_ulp), max_abs, ns,
+                  std_ns);
+    }
+  }
+  nn::simd::set_level(best);
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include "../nn.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations made by steady-state training steps. After a
+// warm-up epoch has sized every buffer, backprop_into + learn, cost,
+// a shuffled Scheduler epoch and InferenceModel::predict must not allocate
+// at all; exits non-zero if they do.
+
+static std::atomic<size_t> allocations{0};
+
+// GCC pairs the replaced operator new with std::free below and warns,
+// even though both sides of the pair are ours
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+static size_t count_allocations(size_t steps, auto&& step) {
+  step();  // warm-up sizes the buffers
+  size_t before = allocations.load();
+  for (size_t i = 0; i < steps; ++i) {
+    step();
+  }
+  return allocations.load() - before;
+}
+
+int main() {
+  std::vector<size_t> arch = {16, 64, 32, 4};
+  nn::NeuralNetwork net(arch);
+  net.randomize(-1.0f, 1.0f);
+
+  nn::Matrix train(1000, arch.front() + arch.back());
+  train.randomize(0.0f, 1.0f);
+
+  nn::NeuralNetwork g(arch);
+  size_t step = count_allocations(100, [&] {
+    net.backprop_into(train, g);
+    net.learn(g, 0.1f);
+  });
+
+  size_t eval = count_allocations(100, [&] { (void)net.cost(train); });
+
+  nn::Scheduler batches(64);
+  size_t epoch = count_allocations(10, [&] {
+    batches.run_epoch(net, train, 0.1f);
+  });
+
+  nn::InferenceModel model(net);
+  std::vector<float> y(arch.back());
+  size_t serve = count_allocations(100, [&] {
+    model.predict(&train(0, 0), y.data());
+  });
+
+  std::printf("backprop_into + learn: %zu allocations in 100 steps\n", step);
+  std::printf("cost:                  %zu allocations in 100 calls\n", eval);
+  std::printf("Scheduler::run_epoch:  %zu allocations in 10 epochs\n", epoch);
+  std::printf("InferenceModel:        %zu allocations in 100 calls\n", serve);
+  return step == 0 && eval == 0 && epoch == 0 && serve == 0 ? 0 : 1;
+}
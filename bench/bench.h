@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+// Timing helpers shared by the bench programs.
+
+// mean seconds per call of f, calling it back to back for min_seconds
+template <typename F>
+inline double time_it(F&& f, double min_seconds = 0.2) {
+  using clock = std::chrono::steady_clock;
+  size_t reps = 0;
+  auto start = clock::now();
+  double elapsed = 0.0;
+  do {
+    f();
+    ++reps;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_seconds);
+  return elapsed / reps;
+}
+
+// per-call seconds over a run of samples
+struct Timing {
+  size_t calls = 0;
+  double median = 0.0, min = 0.0, mean = 0.0;
+};
+
+// samples of `inner` back-to-back calls of f, inner sized so a sample
+// takes about min_time / 20, until min_time has passed and there are 5
+// samples. One call first warms up caches, scratch buffers and the pool.
+template <typename F>
+inline Timing sample(F&& f, double min_time) {
+  using clock = std::chrono::steady_clock;
+  auto seconds = [](clock::time_point a, clock::time_point b) {
+    return std::chrono::duration<double>(b - a).count();
+  };
+  f();
+  size_t inner = 1;
+  for (;;) {
+    auto start = clock::now();
+    for (size_t i = 0; i < inner; ++i) {
+      f();
+    }
+    if (seconds(start, clock::now()) >= min_time / 20 ||
+        inner >= (size_t(1) << 20)) {
+      break;
+    }
+    inner *= 2;
+  }
+  std::vector<double> samples;
+  auto begin = clock::now();
+  while (samples.size() < 5 || seconds(begin, clock::now()) < min_time) {
+    auto start = clock::now();
+    for (size_t i = 0; i < inner; ++i) {
+      f();
+    }
+    samples.push_back(seconds(start, clock::now()) / inner);
+  }
+  Timing t;
+  t.calls = samples.size() * inner;
+  for (double s : samples) {
+    t.mean += s / samples.size();
+  }
+  std::sort(samples.begin(), samples.end());
+  t.min = samples.front();
+  t.median = samples[samples.size() / 2];
+  return t;
+}
@@ -0,0 +1,94 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+
+// Saves a 784-1024-1024-10 model, then compares the time to get a usable
+// model back through load_checkpoint (read + copy) and MappedModel::open
+// (mmap, weights used in place), and checks both predict the same thing.
+// Also checks that a file whose widths overflow the offset arithmetic is
+// rejected rather than mapped.
+
+using clock_type = std::chrono::steady_clock;
+
+static double ms_since(clock_type::time_point start) {
+  return std::chrono::duration<double, std::milli>(clock_type::now() - start)
+      .count();
+}
+
+int main() {
+  using A = nn::Activation;
+  nn::NeuralNetwork net(
+      {{784}, {1024, A::Relu}, {1024, A::Relu}, {10, A::Softmax}});
+  net.randomize(-0.05f, 0.05f);
+
+  auto path = std::filesystem::temp_directory_path() / "tinynn_bench.ckpt";
+  auto start = clock_type::now();
+  if (!nn::save_checkpoint(net, path)) {
+    std::printf("save failed\n");
+    return 1;
+  }
+  std::printf("save:  %8.3f ms (%.1f MB)\n", ms_since(start),
+              std::filesystem::file_size(path) / 1e6);
+
+  start = clock_type::now();
+  auto loaded = nn::load_checkpoint(path);
+  double load_ms = ms_since(start);
+
+  start = clock_type::now();
+  auto mapped = nn::MappedModel::open(path);
+  double map_ms = ms_since(start);
+
+  if (!loaded || !mapped) {
+    std::printf("reload failed\n");
+    return 1;
+  }
+  std::printf("load:  %8.3f ms\nmmap:  %8.3f ms\n", load_ms, map_ms);
+
+  nn::Matrix input(32, 784);
+  input.randomize(0.0f, 1.0f);
+  net.get_input() = input;
+  net.forward();
+  loaded->get_input() = input;
+  loaded->forward();
+  nn::Matrix out;
+  mapped->predict(input, out);
+
+  float err = 0.0f;
+  for (size_t i = 0; i < out.data.size(); ++i) {
+    err = std::max(err, std::abs(out.data[i] - net.get_output().data[i]));
+    err = std::max(err,
+                   std::abs(loaded->get_output().data[i] -
+                            net.get_output().data[i]));
+  }
+  std::printf("max abs diff vs original: %.3e %s\n", err,
+              err == 0.0f ? "ok" : "FAIL");
+
+  // 2^32 x 2^32 floats wraps to 0 bytes: without the overflow checks the
+  // layout would match this 128 byte file
+  bool rejected = false;
+  {
+    nn::CheckpointLayout layout;
+    layout.arch = {1, 1};
+    layout.acts = {A::Identity};
+    layout.compute_offsets();
+    nn::CheckpointHeader h{};
+    std::memcpy(h.magic, nn::kCheckpointMagic, sizeof(h.magic));
+    h.version = nn::kCheckpointVersion;
+    h.layers = 2;
+    h.alignment = nn::kCheckpointAlignment;
+    h.data_offset = layout.ws_offsets[0];
+    h.file_size = layout.ws_offsets[0];
+    std::vector<std::byte> buf(h.file_size);
+    std::memcpy(buf.data(), &h, sizeof(h));
+    uint64_t widths[2] = {uint64_t{1} << 32, uint64_t{1} << 32};
+    std::memcpy(buf.data() + sizeof(h), widths, sizeof(widths));
+    std::ofstream(path, std::ios::binary | std::ios::trunc)
+        .write(reinterpret_cast<const char*>(buf.data()),
+               static_cast<std::streamsize>(buf.size()));
+    rejected = !nn::load_checkpoint(path) && !nn::MappedModel::open(path);
+  }
+  std::printf("overflowing widths rejected: %s\n", rejected ? "ok" : "FAIL");
+  std::filesystem::remove(path);
+  return err == 0.0f && rejected ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+// nn::fit_output_layer: the y = 3x demo solved in closed form vs its 1000
+// SGD epochs; a noisy linear problem with known weights; inputs far from
+// zero (y = 2 (x - mu) + 5, x = mu +- 1, no l2); a 784-256-10
+// ReLU net whose head is refitted on 20000 rows (checked by the output
+// layer's gradient being ~0 afterwards), timed against SGD epochs, from
+// memory and from a row file; and a sigmoid head.
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static float max_abs(const nn::Matrix& m) {
+  float x = 0.0f;
+  for (float v : m.data) {
+    x = std::max(x, std::abs(v));
+  }
+  return x;
+}
+
+static bool linear_3x() {
+  nn::Matrix t(6, 2, 0.0f);
+  for (size_t i = 0; i < 6; ++i) {
+    t(i, 0) = float(i + 1);
+    t(i, 1) = float(i + 1) * 3;
+  }
+  nn::NeuralNetwork net({1, 1}, nn::Activation::Identity);
+  net.randomize(-1.0f, 1.0f);
+  nn::NeuralNetwork sgd = net;
+
+  auto start = clock_type::now();
+  nn::NeuralNetwork g(sgd.arch);
+  for (size_t epoch = 0; epoch < 1000; ++epoch) {
+    sgd.train_step(t, g, 0.005f);
+  }
+  double t_sgd = seconds_since(start);
+
+  start = clock_type::now();
+  bool fitted = nn::fit_output_layer(net, t);
+  double t_fit = seconds_since(start);
+
+  float w = net.ws[0](0, 0), b = net.bs[0](0, 0);
+  bool ok = fitted && std::abs(w - 3.0f) < 1e-4f && std::abs(b) < 1e-3f;
+  std::printf("3x  | sgd 1000 epochs: w %.4f b %+.4f cost %.2e in %.2f ms\n",
+              sgd.ws[0](0, 0), sgd.bs[0](0, 0), sgd.cost(t), t_sgd * 1e3);
+  std::printf("    | closed form:     w %.4f b %+.4f cost %.2e in %.3f ms %s\n",
+              w, b, net.cost(t), t_fit * 1e3, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// y = x . W + b + noise with known W, b
+static bool noisy_linear() {
+  const size_t n = 50000, k = 64, o = 8;
+  const float noise = 0.1f;
+  nn::Matrix w(k, o), b(1, o), t(n, k + o);
+  w.randomize(-1.0f, 1.0f);
+  b.randomize(-1.0f, 1.0f);
+  t.randomize(-1.0f, 1.0f);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < o; ++j) {
+      float y = b(0, j) + nn::rand_float(-noise, noise);
+      for (size_t p = 0; p < k; ++p) {
+        y += t(i, p) * w(p, j);
+      }
+      t(i, k + j) = y;
+    }
+  }
+  nn::NeuralNetwork net({k, o}, nn::Activation::Identity);
+  auto start = clock_type::now();
+  bool fitted = nn::fit_output_layer(net, t);
+  double t_fit = seconds_since(start);
+  float ew = 0.0f, eb = 0.0f;
+  for (size_t i = 0; i < w.data.size(); ++i) {
+    ew = std::max(ew, std::abs(net.ws[0].data[i] - w.data[i]));
+  }
+  for (size_t j = 0; j < o; ++j) {
+    eb = std::max(eb, std::abs(net.bs[0](0, j) - b(0, j)));
+  }
+  // uniform noise: variance noise^2 / 3 per output
+  float cost = net.cost(t), floor = o * noise * noise / 3.0f;
+  bool ok = fitted && ew < 0.01f && eb < 0.01f && cost < 1.05f * floor;
+  std::printf("%zu x %zu -> %zu, noise %.1f | |W - W*| %.1e, |b - b*| %.1e, "
+              "cost %.4f (noise floor %.4f) in %.1f ms %s\n",
+              n, k, o, noise, ew, eb, cost, floor, t_fit * 1e3,
+              ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// the float GEMMs only see centered chunks, so a large mean in x must not
+// eat the spread the slope is fitted on
+static bool offset_inputs() {
+  const size_t n = 20000;
+  bool ok = true;
+  for (float mu : {1000.0f, 10000.0f}) {
+    nn::Matrix t(n, 2, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+      t(i, 0) = mu + nn::rand_float(-1.0f, 1.0f);
+      t(i, 1) = float(2.0 * (double(t(i, 0)) - mu) + 5.0);
+    }
+    nn::NeuralNetwork net({1, 1}, nn::Activation::Identity);
+    bool fitted = nn::fit_output_layer(net, t, 0.0f);
+    float w = net.ws[0](0, 0), cost = net.cost(t);
+    bool good = fitted && std::abs(w - 2.0f) < 1e-2f && cost < 1e-3f;
+    std::printf("offset %-6g | w %.4f (2), cost %.2e %s\n", mu, w, cost,
+                good ? "ok" : "FAIL");
+    ok &= good;
+  }
+  return ok;
+}
+
+// 784-256-10 with random hidden weights; targets from a random teacher
+static bool hidden_features() {
+  using A = nn::Activation;
+  const size_t n = 20000;
+  nn::NeuralNetwork teacher({{784}, {64, A::Tanh}, {10, A::Identity}});
+  teacher.randomize(-0.1f, 0.1f);
+  nn::Matrix t(n, 794);
+  t.randomize(0.0f, 1.0f);
+  teacher.infer(t.view().col_range(0, 784));
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < 10; ++j) {
+      t(i, 784 + j) = teacher.get_output()(i, j);
+    }
+  }
+
+  nn::NeuralNetwork init({{784}, {256, A::Relu}, {10, A::Identity}});
+  init.randomize(-0.05f, 0.05f);
+  float before = init.cost(t);
+
+  nn::NeuralNetwork net = init;
+  auto start = clock_type::now();
+  bool fitted = nn::fit_output_layer(net, t);
+  double t_fit = seconds_since(start);
+  float after = net.cost(t);
+  // at the optimum the output layer's gradient vanishes (up to l2 * W)
+  nn::NeuralNetwork g = net.backprop(t);
+  float grad = max_abs(g.ws.back()) / max_abs(net.ws.back());
+  bool ok = fitted && after < before && grad < 1e-3f;
+  std::printf("\n784-256-10 relu head, %zu rows | cost %.5f -> %.5f in %.0f "
+              "ms | output grad %.1e %s\n",
+              n, before, after, t_fit * 1e3, grad, ok ? "ok" : "FAIL");
+
+  // for scale: Adam training every layer until it gets as close
+  nn::NeuralNetwork sgd = init;
+  nn::Optimizer adam = nn::Optimizer::adam(1e-3f);
+  nn::Scheduler batches(256);
+  start = clock_type::now();
+  size_t epochs = 0;
+  while (epochs < 20 && sgd.cost(t) > after * 1.1f) {
+    batches.run_epoch(sgd, t, adam);
+    ++epochs;
+  }
+  std::printf("    Adam (all layers): cost %.5f after %zu epochs, %.0f ms\n",
+              sgd.cost(t), epochs, seconds_since(start) * 1e3);
+
+  // from a row file through a DataSource
+  auto path = std::filesystem::temp_directory_path() / "nn_bench_fit.rows";
+  nn::save_rows(t, path);
+  auto src = nn::RowFileSource::open(path);
+  nn::NeuralNetwork streamed = init;
+  start = clock_type::now();
+  bool fitted2 = src && nn::fit_output_layer(streamed, *src);
+  double t_stream = seconds_since(start);
+  std::filesystem::remove(path);
+  float diff = 0.0f;
+  for (size_t i = 0; i < net.ws.back().data.size(); ++i) {
+    diff = std::max(diff, std::abs(net.ws.back().data[i] -
+                                   streamed.ws.back().data[i]));
+  }
+  bool same = fitted2 && diff < 1e-3f * max_abs(net.ws.back());
+  std::printf("    row file source: %.0f ms, max |W diff| %.1e %s\n",
+              t_stream * 1e3, diff, same ? "ok" : "FAIL");
+
+  // thread count only changes the summation order
+  nn::set_num_threads(1);
+  nn::NeuralNetwork one = init;
+  start = clock_type::now();
+  nn::fit_output_layer(one, t);
+  double t_one = seconds_since(start);
+  nn::set_num_threads(0);
+  std::printf("    1 thread: %.0f ms vs %zu threads: %.0f ms\n", t_one * 1e3,
+              nn::get_num_threads(), t_fit * 1e3);
+  return ok && same;
+}
+
+// sigmoid output: fitted on logit(y), so a good start rather than the
+// exact MSE optimum
+static bool sigmoid_head() {
+  using A = nn::Activation;
+  const size_t n = 4096;
+  nn::Matrix t(n, 33);
+  t.randomize(-1.0f, 1.0f);
+  nn::Matrix w(32, 1);
+  w.randomize(-1.0f, 1.0f);
+  for (size_t i = 0; i < n; ++i) {
+    float z = 0.0f;
+    for (size_t p = 0; p < 32; ++p) {
+      z += t(i, p) * w(p, 0);
+    }
+    t(i, 32) = 1.0f / (1.0f + std::exp(-z));
+  }
+  nn::NeuralNetwork net({32, 1}, A::Sigmoid);
+  net.randomize(-1.0f, 1.0f);
+  float before = net.cost(t);
+  bool fitted = nn::fit_output_layer(net, t);
+  float after = net.cost(t);
+  bool ok = fitted && after < 1e-6f;
+  std::printf("\nsigmoid head 32 -> 1 | cost %.4f -> %.2e %s\n", before,
+              after, ok ? "ok" : "FAIL");
+
+  nn::NeuralNetwork relu({32, 1}, A::Relu);
+  bool refused = !nn::fit_output_layer(relu, t);
+  std::printf("relu head rejected: %s\n", refused ? "ok" : "FAIL");
+  return ok && refused;
+}
+
+int main() {
+  bool ok = linear_3x();
+  ok &= noisy_linear();
+  ok &= offset_inputs();
+  ok &= hidden_features();
+  ok &= sigmoid_head();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <vector>
+
+// Checks Matrix::dot against the reference loop and reports GFLOP/s for
+// square shapes and the skinny 1 x N . N x M shape forward() uses.
+
+static float max_rel_error(const nn::Matrix& got, const nn::Matrix& want) {
+  float err = 0.0f;
+  for (size_t i = 0; i < got.data.size(); ++i) {
+    float d = std::abs(got.data[i] - want.data[i]);
+    err = std::max(err, d / std::max(1.0f, std::abs(want.data[i])));
+  }
+  return err;
+}
+
+static void run(size_t m, size_t k, size_t n, bool with_naive) {
+  nn::Matrix a(m, k), b(k, n);
+  a.randomize(-1.0f, 1.0f);
+  b.randomize(-1.0f, 1.0f);
+
+  nn::Matrix fast = nn::Matrix::dot(a, b);
+  nn::Matrix ref = nn::Matrix::dot_naive(a, b);
+  float err = max_rel_error(fast, ref);
+
+  double flops = 2.0 * m * n * k;
+  double t_fast = time_it([&] { fast = nn::Matrix::dot(a, b); });
+  double t_ref = with_naive ? time_it([&] { ref = nn::Matrix::dot_naive(a, b); })
+                            : 0.0;
+
+  std::printf("%5zu x %5zu . %5zu x %5zu | dot %8.2f GFLOP/s", m, k, k, n,
+              flops / t_fast * 1e-9);
+  if (with_naive) {
+    std::printf(" | naive %8.2f GFLOP/s | speedup %6.1fx", flops / t_ref * 1e-9,
+                t_ref / t_fast);
+  }
+  std::printf(" | max rel err %.2e %s\n", err, err < 1e-4f ? "ok" : "FAIL");
+}
+
+int main() {
+  std::printf("square\n");
+  for (size_t n : {32, 64, 128, 256, 512, 1024}) {
+    run(n, n, n, n <= 512);
+  }
+
+  std::printf("\nskinny (1 x N . N x M)\n");
+  for (size_t n : {64, 256, 1024, 4096}) {
+    run(1, n, n, true);
+  }
+  run(1, 784, 256, true);
+  run(1, 256, 128, true);
+
+  std::printf("\nragged edges\n");
+  for (size_t n : {1, 3, 7, 17, 65, 257}) {
+    run(n, n + 3, n + 5, true);
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// nn::HogwildTrainer: checks that the XOR and y = 3x demo problems still
+// converge with several workers racing on the weights, then compares its
+// samples/s with the synchronous nn::ParallelTrainer on 784-256-128-10.
+
+constexpr size_t kWorkers = 4;
+
+static bool xor_converges() {
+  nn::Matrix t(4, 3, 0.0f);
+  float data[4][3] = {{0, 0, 0}, {1, 0, 1}, {0, 1, 1}, {1, 1, 0}};
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      t(i, j) = data[i][j];
+    }
+  }
+  nn::NeuralNetwork net({2, 4, 1});
+  net.randomize(-2.0f, 2.0f);
+  nn::HogwildTrainer trainer(kWorkers);
+  for (size_t epoch = 0; epoch < 20000; ++epoch) {
+    trainer.epoch(net, t, 1, 0.5f);
+  }
+  float cost = net.cost(t);
+  std::printf("xor | %zu workers | cost %.5f %s\n", trainer.worker_count(),
+              cost, cost < 0.01f ? "ok" : "FAIL");
+  return cost < 0.01f;
+}
+
+static bool linear_converges() {
+  nn::Matrix t(6, 2, 0.0f);
+  for (size_t i = 0; i < 6; ++i) {
+    t(i, 0) = float(i + 1);
+    t(i, 1) = float(i + 1) * 3;
+  }
+  nn::NeuralNetwork net({1, 1}, nn::Activation::Identity);
+  net.randomize(-1.0f, 1.0f);
+  nn::HogwildTrainer trainer(kWorkers);
+  for (size_t epoch = 0; epoch < 2000; ++epoch) {
+    trainer.epoch(net, t, 1, 0.005f);
+  }
+  float cost = net.cost(t);
+  bool ok = cost < 0.01f && std::abs(net.ws[0](0, 0) - 3.0f) < 0.05f;
+  std::printf("3x  | %zu workers | cost %.5f, w %.4f, b %.4f %s\n",
+              trainer.worker_count(), cost, net.ws[0](0, 0), net.bs[0](0, 0),
+              ok ? "ok" : "FAIL");
+  return ok;
+}
+
+template <typename Trainer>
+static double samples_per_second(Trainer& trainer, const nn::Matrix& t,
+                                 size_t batch) {
+  nn::NeuralNetwork net({784, 256, 128, 10}, nn::Activation::Sigmoid);
+  net.randomize(-0.1f, 0.1f);
+  trainer.epoch(net, t.view().row_range(0, 4 * batch), batch, 0.01f);
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  trainer.epoch(net, t, batch, 0.01f);
+  double s = std::chrono::duration<double>(clock::now() - start).count();
+  return t.rows / s;
+}
+
+int main() {
+  nn::set_num_threads(kWorkers);
+  bool ok = xor_converges();
+  ok &= linear_converges();
+
+  nn::Matrix t(4096, 794, 0.0f);
+  t.randomize(0.0f, 1.0f);
+
+  std::printf("\n784-256-128-10, %zu threads\n", nn::get_num_threads());
+  for (size_t batch : {8, 32, 128}) {
+    nn::ParallelTrainer sync;
+    nn::HogwildTrainer async;
+    // sync reduces one minibatch across all shards; async gives every
+    // worker its own minibatch of the same size
+    double s = samples_per_second(sync, t, batch * sync.shard_count());
+    double a = samples_per_second(async, t, batch);
+    std::printf("batch %3zu / worker | sync %9.0f samples/s | hogwild %9.0f "
+                "samples/s | %5.2fx\n",
+                batch, s, a, a / s);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include "../nn.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// nn::InferenceModel: single-row latency percentiles against forward()
+// (through get_input) and infer, a check that it matches infer, and a
+// check that concurrent callers get exactly the single-threaded results.
+
+struct Latency {
+  double p50 = 0.0, p99 = 0.0, mean = 0.0;  // microseconds
+};
+
+template <typename F>
+static Latency measure(size_t calls, F&& f) {
+  using clock = std::chrono::steady_clock;
+  for (size_t i = 0; i < calls / 10 + 1; ++i) {
+    f(i);  // warm up caches and buffers
+  }
+  std::vector<double> us(calls);
+  for (size_t i = 0; i < calls; ++i) {
+    auto start = clock::now();
+    f(i);
+    us[i] = std::chrono::duration<double, std::micro>(clock::now() - start)
+                .count();
+  }
+  Latency l;
+  for (double t : us) {
+    l.mean += t / calls;
+  }
+  std::sort(us.begin(), us.end());
+  l.p50 = us[calls / 2];
+  l.p99 = us[std::min(calls - 1, calls * 99 / 100)];
+  return l;
+}
+
+static void print(const char* name, Latency l, double base) {
+  std::printf("  %-16s | p50 %8.2f us | p99 %8.2f us | mean %8.2f us | "
+              "%5.2fx\n",
+              name, l.p50, l.p99, l.mean, base / l.p50);
+}
+
+static bool run(const std::vector<size_t>& arch, size_t calls) {
+  using A = nn::Activation;
+  std::vector<nn::NeuralNetwork::Layer> specs = {{arch.front()}};
+  for (size_t l = 1; l + 1 < arch.size(); ++l) {
+    specs.push_back({arch[l], A::Relu});
+  }
+  specs.push_back({arch.back(), A::Softmax});
+  nn::NeuralNetwork net(specs);
+  net.randomize(-0.05f, 0.05f);
+  nn::InferenceModel model(net);
+
+  const size_t kInputs = 64;
+  nn::Matrix x(kInputs, arch.front());
+  x.randomize(0.0f, 1.0f);
+
+  std::printf("\n");
+  for (size_t l = 0; l < arch.size(); ++l) {
+    std::printf("%s%zu", l ? "-" : "", arch[l]);
+  }
+  std::printf(" relu / softmax, batch 1, %zu calls\n", calls);
+
+  // forward(): copy the row into as[0], then the full forward pass
+  Latency fwd = measure(calls, [&](size_t i) {
+    size_t r = i % kInputs;
+    std::copy(&x(r, 0), &x(r, 0) + x.cols, net.get_input().data.begin());
+    net.forward();
+  });
+  Latency inf = measure(calls, [&](size_t i) {
+    net.infer(x.view().row_range(i % kInputs, 1));
+  });
+  std::vector<float> y(arch.back());
+  Latency packed = measure(calls, [&](size_t i) {
+    model.predict(&x(i % kInputs, 0), y.data());
+  });
+  print("forward()", fwd, fwd.p50);
+  print("infer", inf, fwd.p50);
+  print("InferenceModel", packed, fwd.p50);
+
+  // same results as infer, to rounding (different summation order)
+  nn::Matrix out;
+  model.predict(x, out);
+  net.infer(x);
+  float err = 0.0f;
+  for (size_t i = 0; i < out.data.size(); ++i) {
+    err = std::max(err, std::abs(out.data[i] - net.get_output().data[i]));
+  }
+  bool ok = err < 1e-5f;
+  std::printf("  vs infer: max abs diff %.2e %s\n", err, ok ? "ok" : "FAIL");
+
+  // concurrent callers on one shared model: bit-identical to one caller
+  for (size_t i = 0; i < kInputs; ++i) {
+    model.predict(&x(i, 0), &out(i, 0));
+  }
+  const size_t kThreads = 4;
+  std::vector<nn::Matrix> got(kThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      got[t].resize(kInputs, arch.back());
+      for (size_t rep = 0; rep < 20; ++rep) {
+        for (size_t i = 0; i < kInputs; ++i) {
+          size_t r = (i + t * 7) % kInputs;
+          model.predict(&x(r, 0), &got[t](r, 0));
+        }
+      }
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  bool same = true;
+  for (const nn::Matrix& g : got) {
+    same &= g.data == out.data;
+  }
+  std::printf("  %zu concurrent callers: %s\n", kThreads,
+              same ? "bit-identical ok" : "differ FAIL");
+  return ok && same;
+}
+
+int main() {
+  bool ok = run({784, 256, 128, 10}, 20000);
+  ok &= run({784, 1024, 1024, 10}, 2000);
+  ok &= run({64, 64, 4}, 100000);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <vector>
+
+// Checks the fused GEMM + bias + activation layer against the separate
+// dot / add_row / copy / apply_activation passes it replaces, and times
+// both, plus forward() against the inference-only infer().
+
+static float max_abs_diff(const nn::Matrix& a, const nn::Matrix& b) {
+  float err = 0.0f;
+  for (size_t i = 0; i < a.data.size(); ++i) {
+    err = std::max(err, std::abs(a.data[i] - b.data[i]));
+  }
+  return err;
+}
+
+static void unfused(nn::Matrix& a, nn::Matrix& z, const nn::Matrix& x,
+                    const nn::Matrix& w, const nn::Matrix& b,
+                    nn::Activation act) {
+  nn::Matrix::dot_into(a, x, w);
+  a.add_row(b);
+  z = a;
+  a.apply_activation(act);
+}
+
+static const char* name(nn::Activation act) {
+  switch (act) {
+    case nn::Activation::Sigmoid: return "sigmoid";
+    case nn::Activation::Relu: return "relu";
+    case nn::Activation::Tanh: return "tanh";
+    case nn::Activation::Sin: return "sin";
+    case nn::Activation::Identity: return "identity";
+    case nn::Activation::Softmax: return "softmax";
+  }
+  return "?";
+}
+
+static bool check(size_t m, size_t k, size_t n, nn::Activation act) {
+  nn::Matrix x(m, k), w(k, n), b(1, n);
+  x.randomize(-1.0f, 1.0f);
+  w.randomize(-1.0f, 1.0f);
+  b.randomize(-1.0f, 1.0f);
+  nn::Matrix a0, z0, a1, z1, a2;
+  unfused(a0, z0, x, w, b, act);
+  nn::Matrix::layer_into(a1, x, w, b, act, &z1);
+  nn::Matrix::layer_into(a2, x, w, b, act);
+  float err = std::max({max_abs_diff(a0, a1), max_abs_diff(z0, z1),
+                        max_abs_diff(a0, a2)});
+  if (err > 1e-5f) {
+    std::printf("%5zu x %5zu . %5zu x %5zu %-8s max abs diff %.2e FAIL\n", m,
+                k, k, n, name(act), err);
+    return false;
+  }
+  return true;
+}
+
+static void layer(size_t m, size_t k, size_t n, nn::Activation act) {
+  nn::Matrix x(m, k), w(k, n), b(1, n);
+  x.randomize(-1.0f, 1.0f);
+  w.randomize(-1.0f, 1.0f);
+  b.randomize(-1.0f, 1.0f);
+  nn::Matrix a, z;
+  double t_old = time_it([&] { unfused(a, z, x, w, b, act); });
+  double t_new = time_it([&] { nn::Matrix::layer_into(a, x, w, b, act, &z); });
+  double t_inf = time_it([&] { nn::Matrix::layer_into(a, x, w, b, act); });
+  std::printf("%5zu x %5zu . %5zu x %5zu %-8s | 4 passes %8.1f us | fused "
+              "%8.1f us (%.2fx) | no z %8.1f us (%.2fx)\n",
+              m, k, k, n, name(act), t_old * 1e6, t_new * 1e6, t_old / t_new,
+              t_inf * 1e6, t_old / t_inf);
+}
+
+int main() {
+  const nn::Activation all[] = {
+      nn::Activation::Sigmoid, nn::Activation::Relu, nn::Activation::Tanh,
+      nn::Activation::Sin, nn::Activation::Identity, nn::Activation::Softmax};
+
+  bool ok = true;
+  for (size_t threads : {1, 4}) {
+    nn::set_num_threads(threads);
+    for (nn::Activation act : all) {
+      for (size_t m : {1, 3, 7, 17, 64, 300}) {
+        for (size_t n : {1, 5, 33, 130}) {
+          ok &= check(m, 37, n, act);
+          ok &= check(m, 600, n, act);  // more than one slice of K
+        }
+      }
+    }
+  }
+  nn::set_num_threads(0);
+  std::printf("fused layer vs separate passes: %s\n\n", ok ? "ok" : "FAIL");
+
+  for (nn::Activation act : {nn::Activation::Sigmoid, nn::Activation::Relu}) {
+    layer(256, 784, 256, act);
+    layer(256, 256, 128, act);
+    layer(256, 128, 10, act);
+    layer(1, 784, 256, act);
+  }
+
+  nn::NeuralNetwork net({784, 256, 128, 10});
+  net.randomize(-0.1f, 0.1f);
+  nn::Matrix input(256, 784);
+  input.randomize(0.0f, 1.0f);
+  double t_fwd = time_it([&] { net.forward(input); });
+  double t_inf = time_it([&] { net.infer(input); });
+  std::printf("\n784-256-128-10, batch 256 | forward %8.1f us | infer %8.1f "
+              "us\n",
+              t_fwd * 1e6, t_inf * 1e6);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <vector>
+
+// nn::LU / nn::Cholesky: small exact checks (determinants, singular input,
+// permutation sign), then for n = 64 .. 2048 the time and residual of the
+// old Gauss-Jordan inverse (kept here as gauss_jordan) against the blocked
+// LU inverse, LU / Cholesky factorization and a one-column solve.
+
+// Matrix::inverse as it was: [A | I] reduced in place
+static nn::Matrix gauss_jordan(const nn::Matrix& a) {
+  const size_t n = a.rows;
+  nn::Matrix aug(n, 2 * n, 0.0f);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      aug(i, j) = a(i, j);
+    }
+    aug(i, n + i) = 1.0f;
+  }
+  for (size_t p = 0; p < n; ++p) {
+    size_t max_row = p;
+    for (size_t i = p + 1; i < n; ++i) {
+      if (std::abs(aug(i, p)) > std::abs(aug(max_row, p))) {
+        max_row = i;
+      }
+    }
+    if (max_row != p) {
+      for (size_t j = 0; j < 2 * n; ++j) {
+        std::swap(aug(p, j), aug(max_row, j));
+      }
+    }
+    if (std::abs(aug(p, p)) < 1e-8f) {
+      return nn::Matrix();
+    }
+    float pivot = aug(p, p);
+    for (size_t j = 0; j < 2 * n; ++j) {
+      aug(p, j) /= pivot;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (i != p) {
+        float factor = aug(i, p);
+        for (size_t j = 0; j < 2 * n; ++j) {
+          aug(i, j) -= factor * aug(p, j);
+        }
+      }
+    }
+  }
+  nn::Matrix inv(n, n, 0.0f);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      inv(i, j) = aug(i, n + j);
+    }
+  }
+  return inv;
+}
+
+// max |A X - I|
+static float inverse_residual(const nn::Matrix& a, const nn::Matrix& x) {
+  nn::Matrix ax = nn::Matrix::dot(a, x);
+  float err = 0.0f;
+  for (size_t i = 0; i < ax.rows; ++i) {
+    for (size_t j = 0; j < ax.cols; ++j) {
+      err = std::max(err, std::abs(ax(i, j) - (i == j ? 1.0f : 0.0f)));
+    }
+  }
+  return err;
+}
+
+// max |A x - b| / (max |A| * max |x|)
+static float solve_residual(const nn::Matrix& a, const nn::Matrix& x,
+                            const nn::Matrix& b) {
+  nn::Matrix ax = nn::Matrix::dot(a, x);
+  float err = 0.0f, na = 0.0f, nx = 0.0f;
+  for (size_t i = 0; i < ax.data.size(); ++i) {
+    err = std::max(err, std::abs(ax.data[i] - b.data[i]));
+  }
+  for (float v : a.data) {
+    na = std::max(na, std::abs(v));
+  }
+  for (float v : x.data) {
+    nx = std::max(nx, std::abs(v));
+  }
+  return err / (na * nx);
+}
+
+static nn::Matrix from(size_t n, std::initializer_list<float> values) {
+  nn::Matrix m(n, n);
+  std::copy(values.begin(), values.end(), m.data.begin());
+  return m;
+}
+
+static bool small_checks() {
+  bool ok = true;
+  auto check = [&](const char* what, bool pass) {
+    std::printf("%-44s %s\n", what, pass ? "ok" : "FAIL");
+    ok &= pass;
+  };
+  nn::Matrix a = from(3, {2, -1, 0, -1, 2, -1, 0, -1, 2});  // det 4, SPD
+  check("3x3 determinant (LU)", std::abs(a.determinant() - 4.0f) < 1e-5f);
+  auto c = nn::Cholesky::factor(a);
+  check("3x3 determinant (Cholesky)",
+        c && std::abs(c->determinant() - 4.0f) < 1e-5f);
+  nn::Matrix swap = from(2, {0, 1, 1, 0});  // needs a pivot, det -1
+  check("permutation sign", std::abs(swap.determinant() + 1.0f) < 1e-6f);
+  nn::Matrix singular = from(3, {1, 2, 3, 2, 4, 6, 1, 0, 1});
+  check("singular: empty inverse, det 0, no solve",
+        singular.inverse().data.empty() && singular.determinant() == 0.0f &&
+            !singular.solve(a.view()));
+  nn::Matrix indefinite = from(2, {1, 2, 2, 1});
+  check("indefinite: no Cholesky", !nn::Cholesky::factor(indefinite));
+  check("non-square: empty inverse", nn::Matrix(2, 3).inverse().data.empty());
+
+  // odd size crossing block edges, against the old inverse
+  const size_t n = nn::linalg::kBlock * 2 + 7;
+  nn::Matrix r(n, n);
+  r.randomize(-1.0f, 1.0f);
+  nn::Matrix inv = r.inverse();
+  float err = inverse_residual(r, inv);
+  float old = inverse_residual(r, gauss_jordan(r));
+  std::printf("%zu x %zu |A A^-1 - I|: LU %.1e, Gauss-Jordan %.1e\n", n, n,
+              err, old);
+  check("blocked LU inverse as accurate as Gauss-Jordan",
+        err < std::max(1e-3f, 4.0f * old));
+  return ok;
+}
+
+static const size_t kSizes[] = {64, 128, 256, 512, 1024, 2048};
+
+int main() {
+  bool ok = small_checks();
+
+  std::printf("\n%5s | %20s | %20s | %10s | %10s | %10s | %8s\n", "n",
+              "Gauss-Jordan inverse", "LU inverse", "LU factor", "Cholesky",
+              "solve", "speedup");
+  for (size_t n : kSizes) {
+    nn::Matrix a(n, n);
+    a.randomize(-1.0f, 1.0f);
+    for (size_t i = 0; i < n; ++i) {
+      a(i, i) += 4.0f;  // keep the condition number modest
+    }
+    // SPD: A A^T + n I
+    nn::Matrix at = a;
+    at.transpose();
+    nn::Matrix spd = nn::Matrix::dot(a, at);
+    for (size_t i = 0; i < n; ++i) {
+      spd(i, i) += float(n);
+    }
+    nn::Matrix b(n, 1);
+    b.randomize(-1.0f, 1.0f);
+
+    nn::Matrix old_inv, new_inv;
+    double t_old =
+        time_it([&] { old_inv = gauss_jordan(a); }, n > 512 ? 0.0 : 0.2);
+    double t_inv = time_it([&] { new_inv = a.inverse(); });
+    double t_lu = time_it([&] { (void)nn::LU::factor(a); });
+    double t_chol = time_it([&] { (void)nn::Cholesky::factor(spd); });
+    auto lu = nn::LU::factor(a);
+    nn::Matrix x;
+    double t_solve = time_it([&] { x = lu->solve(b); });
+    float e_old = inverse_residual(a, old_inv);
+    float e_new = inverse_residual(a, new_inv);
+    float e_solve = solve_residual(a, x, b);
+    auto chol = nn::Cholesky::factor(spd);
+    float e_chol = chol ? solve_residual(spd, chol->solve(b), b) : 1.0f;
+    std::printf("%5zu | %9.2f ms (%.0e) | %9.2f ms (%.0e) | %7.2f ms | "
+                "%7.2f ms | %7.3f ms | %7.1fx\n",
+                n, t_old * 1e3, e_old, t_inv * 1e3, e_new, t_lu * 1e3,
+                t_chol * 1e3, t_solve * 1e3, t_old / t_inv);
+    // float backward error grows about linearly with n
+    float tol = 2e-7f * n;
+    bool pass = e_new < std::max(1e-3f, 4.0f * e_old) && e_solve < tol &&
+                e_chol < tol;
+    if (!pass) {
+      std::printf("      residuals: solve %.1e, Cholesky solve %.1e FAIL\n",
+                  e_solve, e_chol);
+    }
+    ok &= pass;
+  }
+  return ok ? 0 : 1;
+}
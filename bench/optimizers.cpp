@@ -0,0 +1,166 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <vector>
+
+// nn::Optimizer: checks the SIMD update loops against the scalar formulas
+// and that the state follows a change of network shape, counts the epochs
+// each method needs to bring XOR under a target cost, and times one update
+// of a 784 x 256 layer against learn().
+
+using Kind = nn::Optimizer::Kind;
+
+static const char* name(Kind k) {
+  switch (k) {
+    case Kind::Sgd: return "sgd";
+    case Kind::Momentum: return "momentum";
+    case Kind::Nesterov: return "nesterov";
+    case Kind::RMSProp: return "rmsprop";
+    case Kind::Adam: return "adam";
+    case Kind::AdamW: return "adamw";
+  }
+  return "?";
+}
+
+static const Kind kAll[] = {Kind::Sgd,     Kind::Momentum, Kind::Nesterov,
+                            Kind::RMSProp, Kind::Adam,     Kind::AdamW};
+
+// Optimizer::step vs update_one on every element, over a few steps
+static bool check(Kind k) {
+  nn::NeuralNetwork net({13, 37, 5});  // odd sizes leave vector tails
+  net.randomize(-1.0f, 1.0f);
+  nn::NeuralNetwork g({13, 37, 5});
+  nn::Optimizer opt(k, 0.01f);
+  opt.weight_decay = 0.01f;
+
+  std::vector<float> w, m, v;
+  for (size_t l = 0; l < net.ws.size(); ++l) {
+    w.insert(w.end(), net.ws[l].data.begin(), net.ws[l].data.end());
+    w.insert(w.end(), net.bs[l].data.begin(), net.bs[l].data.end());
+  }
+  m.assign(w.size(), 0.0f);
+  v.assign(w.size(), 0.0f);
+
+  float err = 0.0f;
+  for (size_t step = 1; step <= 5; ++step) {
+    g.randomize(-1.0f, 1.0f);
+    opt.step(net, g);
+
+    nn::optim::Step s{opt.rate, opt.beta1, opt.beta2, opt.eps,
+                      opt.weight_decay, 1.0f, 1.0f, 1.0f};
+    if (k >= Kind::Adam) {
+      s.m_scale = 1.0f / (1.0f - std::pow(opt.beta1, float(step)));
+      s.v_scale = 1.0f / std::sqrt(1.0f - std::pow(opt.beta2, float(step)));
+    }
+    if (k == Kind::AdamW) {
+      s.decay = 0.0f;
+      s.shrink = 1.0f - opt.rate * opt.weight_decay;
+    }
+    size_t i = 0;
+    for (size_t l = 0; l < net.ws.size(); ++l) {
+      for (const nn::Matrix* t : {&g.ws[l], &g.bs[l]}) {
+        for (float gi : t->data) {
+          nn::optim::with_kind(k, [&](auto tag) {
+            nn::optim::update_one<decltype(tag)::value>(w[i], gi, m[i], v[i],
+                                                        s);
+          });
+          ++i;
+        }
+      }
+    }
+  }
+  size_t i = 0;
+  for (size_t l = 0; l < net.ws.size(); ++l) {
+    for (const nn::Matrix* t : {&net.ws[l], &net.bs[l]}) {
+      for (float x : t->data) {
+        float d = std::abs(x - w[i++]);
+        err = std::max(err, d / std::max(1.0f, std::abs(x)));
+      }
+    }
+  }
+  bool ok = err < 1e-5f;
+  std::printf("%-8s | simd vs scalar max rel err %.2e %s\n", name(k), err,
+              ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// one Adam moving on to a net of the same depth but other widths must
+// start its state over instead of writing through the old buffers
+static bool check_reshape() {
+  nn::NeuralNetwork a({4, 8, 2}), b({4, 64, 2});
+  nn::NeuralNetwork ga(a.arch), gb(b.arch);
+  ga.randomize(-1.0f, 1.0f);
+  gb.randomize(-1.0f, 1.0f);
+  nn::Optimizer opt = nn::Optimizer::adam(0.01f);
+  opt.step(a, ga);
+  opt.step(a, ga);
+  opt.step(b, gb);
+  bool ok = opt.steps == 1 && opt.m.size() == 4 &&
+            opt.m[0].rows == 4 && opt.m[0].cols == 64 &&
+            opt.v[2].rows == 64 && opt.v[2].cols == 2;
+  std::printf("%-8s | state reset on a new shape %s\n", "adam",
+              ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// epochs of full-batch training until XOR's cost drops under target
+static size_t epochs_to(nn::Optimizer opt, float target, size_t limit) {
+  nn::Matrix t(4, 3, 0.0f);
+  float data[4][3] = {{0, 0, 0}, {1, 0, 1}, {0, 1, 1}, {1, 1, 0}};
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      t(i, j) = data[i][j];
+    }
+  }
+  // same start for every optimizer
+  static nn::NeuralNetwork init = [] {
+    nn::NeuralNetwork net({2, 4, 1});
+    net.randomize(-2.0f, 2.0f);
+    return net;
+  }();
+  nn::NeuralNetwork net = init;
+  nn::NeuralNetwork g(net.arch);
+  for (size_t epoch = 1; epoch <= limit; ++epoch) {
+    net.backprop_into(t, g);
+    opt.step(net, g);
+    if (net.cost(t) < target) {
+      return epoch;
+    }
+  }
+  return limit;
+}
+
+int main() {
+  bool ok = true;
+  for (Kind k : kAll) {
+    ok &= check(k);
+  }
+  ok &= check_reshape();
+
+  const float target = 0.01f;
+  const size_t limit = 200000;
+  std::printf("\nXOR 2-4-1, full batch, epochs until cost < %g\n", target);
+  for (nn::Optimizer opt :
+       {nn::Optimizer::sgd(0.5f), nn::Optimizer::momentum(0.5f),
+        nn::Optimizer::nesterov(0.5f), nn::Optimizer::rmsprop(0.01f),
+        nn::Optimizer::adam(0.05f), nn::Optimizer::adamw(0.05f, 1e-4f)}) {
+    size_t epochs = epochs_to(opt, target, limit);
+    std::printf("%-8s rate %-5g | %6zu epochs%s\n", name(opt.kind), opt.rate,
+                epochs, epochs == limit ? " (did not reach target)" : "");
+  }
+
+  std::printf("\none update of a 784 x 256 layer\n");
+  nn::NeuralNetwork net({784, 256});
+  nn::NeuralNetwork g({784, 256});
+  net.randomize(-0.1f, 0.1f);
+  g.randomize(-0.1f, 0.1f);
+  time_it([&] { net.learn(g, 1e-6f); });  // warm up
+  double t_learn = time_it([&] { net.learn(g, 1e-6f); });
+  std::printf("%-8s | %7.1f us\n", "learn", t_learn * 1e6);
+  for (Kind k : kAll) {
+    nn::Optimizer opt(k, 1e-6f);
+    double t = time_it([&] { opt.step(net, g); });
+    std::printf("%-8s | %7.1f us\n", name(k), t * 1e6);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Training throughput of nn::ParallelTrainer on a 784-256-128-10 network
+// (MNIST-sized) from 1 to N threads, plus two checks: a fixed shard count
+// gives bit-identical weights on repeated runs, and the sharded gradient
+// matches the single-threaded backprop.
+
+static const std::vector<size_t> kArch = {784, 256, 128, 10};
+constexpr size_t kSamples = 4096;
+constexpr size_t kBatch = 256;
+
+// every run starts from the same weights
+static nn::NeuralNetwork fresh() {
+  static nn::NeuralNetwork init = [] {
+    nn::NeuralNetwork net(kArch, nn::Activation::Sigmoid);
+    net.randomize(-0.1f, 0.1f);
+    return net;
+  }();
+  return init;
+}
+
+static float max_abs_diff(const nn::NeuralNetwork& a,
+                          const nn::NeuralNetwork& b) {
+  float err = 0.0f;
+  for (size_t l = 0; l < a.ws.size(); ++l) {
+    for (size_t i = 0; i < a.ws[l].data.size(); ++i) {
+      err = std::max(err, std::abs(a.ws[l].data[i] - b.ws[l].data[i]));
+    }
+    for (size_t i = 0; i < a.bs[l].data.size(); ++i) {
+      err = std::max(err, std::abs(a.bs[l].data[i] - b.bs[l].data[i]));
+    }
+  }
+  return err;
+}
+
+int main() {
+  nn::Matrix t(kSamples, kArch.front() + kArch.back(), 0.0f);
+  t.randomize(0.0f, 1.0f);
+  for (size_t i = 0; i < kSamples; ++i) {
+    for (size_t j = 0; j < kArch.back(); ++j) {
+      t(i, kArch.front() + j) = j == i % kArch.back() ? 1.0f : 0.0f;
+    }
+  }
+  nn::MatrixView sample = t.view().row_range(0, kBatch);
+
+  // sharded gradient vs plain backprop
+  nn::NeuralNetwork net = fresh();
+  nn::NeuralNetwork want = net.backprop(sample);
+  nn::ParallelTrainer four(4);
+  float err = max_abs_diff(four.gradient(net, sample), want);
+  std::printf("4 shards vs backprop: max abs diff %.2e %s\n", err,
+              err < 1e-6f ? "ok" : "FAIL");
+  bool ok = err < 1e-6f;
+
+  // reproducible for a fixed shard count, whatever the pool size
+  nn::NeuralNetwork a = fresh(), b = fresh();
+  nn::set_num_threads(1);
+  nn::ParallelTrainer(4).epoch(a, t, kBatch, 0.1f);
+  nn::set_num_threads(3);
+  nn::ParallelTrainer(4).epoch(b, t, kBatch, 0.1f);
+  nn::set_num_threads(0);
+  bool same = max_abs_diff(a, b) == 0.0f;
+  std::printf("4 shards on 1 vs 3 threads: %s\n",
+              same ? "bit-identical ok" : "differ FAIL");
+  ok &= same;
+
+  std::printf("\n784-256-128-10, minibatch %zu\n", kBatch);
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  double base = 0.0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    nn::set_num_threads(threads);
+    nn::NeuralNetwork n = fresh();
+    nn::ParallelTrainer trainer;
+    // warm up: first step sizes the shard workspaces
+    trainer.epoch(n, t.view().row_range(0, kBatch), kBatch, 0.1f);
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    trainer.epoch(n, t, kBatch, 0.1f);
+    double s = std::chrono::duration<double>(clock::now() - start).count();
+    double rate = kSamples / s;
+    if (threads == 1) {
+      base = rate;
+    }
+    std::printf("%3zu threads | %9.0f samples/s | %5.2fx\n", threads, rate,
+                rate / base);
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;  // make the last row the full machine
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// bf16 / fp16 weight storage: checks the hardware conversions (F16C,
+// AVX512-BF16) bit for bit against the portable ones, times both, compares
+// GEMM throughput and error with fp32 / bf16 / fp16 weights, checks that
+// randomize() / zero() after set_precision() reach the forward pass, and
+// trains the two demo problems (XOR, y = 3x) in each precision to show what
+// the rounding does to the final accuracy.
+
+using Level = nn::simd::Level;
+
+static const char* name(Level l) {
+  switch (l) {
+    case Level::Generic: return "generic";
+    case Level::AVX2: return "avx2";
+    case Level::AVX512: return "avx512";
+  }
+  return "?";
+}
+
+static const char* name(nn::Precision p) {
+  switch (p) {
+    case nn::Precision::F32: return "fp32";
+    case nn::Precision::BF16: return "bf16";
+    case nn::Precision::FP16: return "fp16";
+  }
+  return "?";
+}
+
+static float from_bits(uint32_t x) {
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+static uint32_t to_bits(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+// every fp16 / bf16 pattern widened, and 2^20 random fp32 patterns plus
+// the edge cases narrowed, at the current level vs the scalar functions
+static bool check_conversions() {
+  std::vector<float> src;
+  for (float f : {0.0f, -0.0f, 1.0f, 65504.0f, 65520.0f, 65519.99f, 1e-8f,
+                  2.9802322e-8f, 5.9604645e-8f, 6.097555e-5f, 3.4e38f}) {
+    src.push_back(f);
+    src.push_back(-f);
+  }
+  src.push_back(from_bits(0x7f800000u));  // inf
+  src.push_back(from_bits(0x7fc00001u));  // quiet NaN with payload
+  src.push_back(from_bits(0xff800001u));  // signalling NaN
+  std::mt19937 gen(1);
+  while (src.size() < (size_t(1) << 20)) {
+    src.push_back(from_bits(gen()));
+  }
+  size_t n = src.size();
+  std::vector<nn::bf16> b(n);
+  std::vector<nn::fp16> h(n);
+  std::vector<float> back(65536);
+  std::vector<nn::bf16> all_b(65536);
+  std::vector<nn::fp16> all_h(65536);
+  for (uint32_t i = 0; i < 65536; ++i) {
+    all_b[i].bits = uint16_t(i);
+    all_h[i].bits = uint16_t(i);
+  }
+
+  bool ok = true;
+  for (Level l : {Level::Generic, Level::AVX2, Level::AVX512}) {
+    nn::simd::set_level(l);
+    if (nn::simd::level() != l) {
+      continue;
+    }
+    size_t bad = 0;
+    nn::convert(src.data(), b.data(), n);
+    nn::convert(src.data(), h.data(), n);
+    for (size_t i = 0; i < n; ++i) {
+      // VCVTNEPS2BF16 flushes fp32 denormals to zero
+      bool denormal = (to_bits(src[i]) & 0x7f800000u) == 0;
+      bad += !denormal && b[i].bits != nn::half::to_bf16(src[i]).bits;
+      bad += h[i].bits != nn::half::to_fp16(src[i]).bits;
+    }
+    nn::convert(all_b.data(), back.data(), 65536);
+    for (uint32_t i = 0; i < 65536; ++i) {
+      bad += to_bits(back[i]) != to_bits(nn::half::to_float(all_b[i]));
+    }
+    nn::convert(all_h.data(), back.data(), 65536);
+    for (uint32_t i = 0; i < 65536; ++i) {
+      bad += to_bits(back[i]) != to_bits(nn::half::to_float(all_h[i]));
+    }
+    std::printf("%-8s | conversions vs scalar: %zu mismatches %s\n", name(l),
+                bad, bad == 0 ? "ok" : "FAIL");
+    ok &= bad == 0;
+  }
+  nn::simd::set_level(Level::AVX512);
+
+  // spot checks of the scalar functions themselves
+  bool spot = nn::half::to_fp16(1.0f).bits == 0x3c00 &&
+              nn::half::to_fp16(65504.0f).bits == 0x7bff &&
+              nn::half::to_fp16(65520.0f).bits == 0x7c00 &&
+              nn::half::to_fp16(5.9604645e-8f).bits == 0x0001 &&
+              nn::half::to_fp16(2.9802322e-8f).bits == 0x0000 &&
+              nn::half::to_float(nn::fp16{0x3555}) == 0.33325195f &&
+              nn::half::to_bf16(1.00390625f).bits == 0x3f80 &&  // tie, even
+              nn::half::to_bf16(1.01171875f).bits == 0x3f82 &&  // tie, up
+              nn::half::to_float(nn::bf16{0x4049}) == 3.140625f;
+  std::printf("scalar spot checks: %s\n", spot ? "ok" : "FAIL");
+  return ok && spot;
+}
+
+static void conversion_speed() {
+  const size_t n = size_t(1) << 22;
+  std::vector<float> f(n), back(n);
+  for (auto& x : f) {
+    x = nn::rand_float(-4.0f, 4.0f);
+  }
+  std::vector<nn::bf16> b(n);
+  std::vector<nn::fp16> h(n);
+  std::printf("\nconversion, %zu values (GB/s of fp32 side)\n", n);
+  for (Level l : {Level::Generic, Level::AVX2, Level::AVX512}) {
+    nn::simd::set_level(l);
+    if (nn::simd::level() != l) {
+      continue;
+    }
+    double gb = n * sizeof(float) / 1e9;
+    double t0 = time_it([&] { nn::convert(f.data(), b.data(), n); });
+    double t1 = time_it([&] { nn::convert(b.data(), back.data(), n); });
+    double t2 = time_it([&] { nn::convert(f.data(), h.data(), n); });
+    double t3 = time_it([&] { nn::convert(h.data(), back.data(), n); });
+    std::printf("%-8s | f32->bf16 %6.2f | bf16->f32 %6.2f | f32->fp16 %6.2f "
+                "| fp16->f32 %6.2f\n",
+                name(l), gb / t0, gb / t1, gb / t2, gb / t3);
+  }
+  nn::simd::set_level(Level::AVX512);
+}
+
+// x . W with W in fp32 / bf16 / fp16; error is relative to the largest
+// entry of the fp32 result
+static bool gemm(size_t m, size_t k, size_t n) {
+  nn::Matrix x(m, k), w(k, n), y32, y;
+  x.randomize(-1.0f, 1.0f);
+  w.randomize(-1.0f, 1.0f);
+  nn::TypedMatrix<nn::bf16> wb(w);
+  nn::TypedMatrix<nn::fp16> wh(w);
+  double t32 = time_it([&] { nn::Matrix::dot_into(y32, x, w); });
+  float scale = 0.0f;
+  for (float v : y32.data) {
+    scale = std::max(scale, std::abs(v));
+  }
+  auto err = [&] {
+    float e = 0.0f;
+    for (size_t i = 0; i < y.data.size(); ++i) {
+      e = std::max(e, std::abs(y.data[i] - y32.data[i]));
+    }
+    return e / scale;
+  };
+  double tb = time_it([&] { nn::Matrix::dot_into(y, x, wb); });
+  float eb = err();
+  double th = time_it([&] { nn::Matrix::dot_into(y, x, wh); });
+  float eh = err();
+  double flops = 2.0 * m * n * k;
+  std::printf("%4zu x %4zu . %4zu x %4zu | fp32 %6.1f GFLOP/s | bf16 %6.1f "
+              "(%.2fx, err %.1e) | fp16 %6.1f (%.2fx, err %.1e)\n",
+              m, k, k, n, flops / t32 / 1e9, flops / tb / 1e9, t32 / tb, eb,
+              flops / th / 1e9, t32 / th, eh);
+  // bf16 keeps 8 bits of each weight, fp16 11
+  return eb < 1e-2f && eh < 2e-3f;
+}
+
+// randomize() and zero() after set_precision() must re-round the copies
+// the forward pass reads, not leave it on the weights from before
+static bool check_rerounding() {
+  nn::Matrix x(8, 16);
+  x.randomize(0.0f, 1.0f);
+  bool ok = true;
+  for (nn::Precision p : {nn::Precision::BF16, nn::Precision::FP16}) {
+    nn::NeuralNetwork net({16, 32, 4}, nn::Activation::Tanh);
+    net.set_precision(p);
+    net.randomize(-1.0f, 1.0f);
+    nn::NeuralNetwork ref = net;
+    ref.set_precision(nn::Precision::F32);
+    net.infer(x);
+    ref.infer(x);
+    float err = 0.0f;
+    for (size_t i = 0; i < ref.get_output().data.size(); ++i) {
+      err = std::max(err, std::abs(net.get_output().data[i] -
+                                   ref.get_output().data[i]));
+    }
+    net.zero();
+    net.infer(x);
+    bool zeroed = true;
+    for (float y : net.get_output().data) {
+      zeroed &= y == 0.0f;
+    }
+    bool good = err < 5e-2f && zeroed;
+    std::printf("%-4s | randomize / zero after set_precision: max abs err "
+                "%.2e %s\n",
+                name(p), err, good ? "ok" : "FAIL");
+    ok &= good;
+  }
+  return ok;
+}
+
+static nn::Matrix xor_data() {
+  nn::Matrix t(4, 3, 0.0f);
+  float data[4][3] = {{0, 0, 0}, {1, 0, 1}, {0, 1, 1}, {1, 1, 0}};
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      t(i, j) = data[i][j];
+    }
+  }
+  return t;
+}
+
+// demo/xor_nn.cpp's setup: 2-4-1 sigmoid, Adam 0.05, batch 1, 2000 epochs
+static float train_xor(nn::Precision p) {
+  static nn::NeuralNetwork init = [] {
+    nn::NeuralNetwork net({2, 4, 1});
+    net.randomize(-2.0f, 2.0f);
+    return net;
+  }();
+  nn::Matrix t = xor_data();
+  nn::NeuralNetwork net = init;
+  net.set_precision(p);
+  nn::Optimizer adam = nn::Optimizer::adam(0.05f);
+  nn::Scheduler batches(1, true, 7);
+  for (size_t epoch = 0; epoch < 2000; ++epoch) {
+    batches.run_epoch(net, t, adam);
+  }
+  return net.cost(t);
+}
+
+// demo/3x.cpp's setup: y = 3x on x = 1..6, SGD 0.005, 1000 epochs
+static float train_3x(nn::Precision p, float& w, float& b) {
+  static nn::NeuralNetwork init = [] {
+    nn::NeuralNetwork net({1, 1}, nn::Activation::Identity);
+    net.randomize(-1.0f, 1.0f);
+    return net;
+  }();
+  nn::Matrix t(6, 2, 0.0f);
+  for (size_t i = 0; i < 6; ++i) {
+    t(i, 0) = float(i + 1);
+    t(i, 1) = float(i + 1) * 3;
+  }
+  nn::NeuralNetwork net = init;
+  net.set_precision(p);
+  nn::NeuralNetwork g(net.arch);
+  for (size_t epoch = 0; epoch < 1000; ++epoch) {
+    net.train_step(t, g, 0.005f);
+  }
+  w = net.ws[0](0, 0);
+  b = net.bs[0](0, 0);
+  return net.cost(t);
+}
+
+int main() {
+  bool ok = check_conversions();
+  conversion_speed();
+
+  std::printf("\nGEMM with reduced-precision B, %zu threads\n",
+              nn::get_num_threads());
+  ok &= gemm(1, 4096, 4096);  // 64 MB of fp32 weights: bandwidth bound
+  ok &= gemm(4, 1024, 4096);
+  ok &= gemm(256, 784, 256);
+  ok &= gemm(256, 1024, 1024);
+
+  std::printf("\n");
+  ok &= check_rerounding();
+
+  std::printf("\nmodel 784-1024-1024-10, batch 1 / 256 forward (infer)\n");
+  nn::NeuralNetwork net({784, 1024, 1024, 10});
+  net.randomize(-0.05f, 0.05f);
+  nn::Matrix x1(1, 784), x256(256, 784);
+  x1.randomize(0.0f, 1.0f);
+  x256.randomize(0.0f, 1.0f);
+  for (nn::Precision p :
+       {nn::Precision::F32, nn::Precision::BF16, nn::Precision::FP16}) {
+    net.set_precision(p);
+    double t1 = time_it([&] { net.infer(x1); });
+    double t256 = time_it([&] { net.infer(x256); });
+    std::printf("%-4s | batch 1 %8.1f us | batch 256 %8.1f us\n", name(p),
+                t1 * 1e6, t256 * 1e6);
+  }
+
+  std::printf("\ndemos trained from the same start, fp32 master weights\n");
+  float xor32 = 0.0f, lin32 = 0.0f;
+  for (nn::Precision p :
+       {nn::Precision::F32, nn::Precision::BF16, nn::Precision::FP16}) {
+    float xor_cost = train_xor(p);
+    float w, b;
+    float lin_cost = train_3x(p, w, b);
+    if (p == nn::Precision::F32) {
+      xor32 = xor_cost;
+      lin32 = lin_cost;
+    }
+    std::printf("%-4s | xor cost %.2e (%+.1e) | 3x cost %.2e (%+.1e), w %.4f,"
+                " b %+.4f\n",
+                name(p), xor_cost, xor_cost - xor32, lin_cost,
+                lin_cost - lin32, w, b);
+    ok &= xor_cost < 0.01f && lin_cost < 0.05f;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#define NN_PROFILE
+#define NN_PROFILE_ALLOCS
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// nn::prof on a 784-256-128-10 ReLU net trained with Adam in shuffled
+// batches of 256: prints the per-phase / layer / step table of one epoch
+// after a warm-up epoch, checks that every step was recorded the expected
+// number of times without allocating, that the events cover the epoch's
+// wall time, and that the Chrome trace holds every event. Also times a
+// bare scope, the cost of the instrumentation when it is compiled in.
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static const nn::prof::Row* find(const std::vector<nn::prof::Row>& rows,
+                                 nn::prof::Phase phase, int layer,
+                                 const char* name) {
+  for (const auto& r : rows) {
+    if (r.phase == phase && r.layer == layer &&
+        std::string(r.name) == name) {
+      return &r;
+    }
+  }
+  return nullptr;
+}
+
+static size_t count(const std::string& text, const std::string& what) {
+  size_t n = 0;
+  for (size_t pos = text.find(what); pos != std::string::npos;
+       pos = text.find(what, pos + 1)) {
+    ++n;
+  }
+  return n;
+}
+
+int main() {
+  using A = nn::Activation;
+  using P = nn::prof::Phase;
+  const size_t rows = 10240, batch = 256;
+  nn::NeuralNetwork net({{784}, {256, A::Relu}, {128, A::Relu},
+                         {10, A::Identity}});
+  net.randomize(-0.05f, 0.05f);
+  nn::Matrix t(rows, 794);
+  t.randomize(0.0f, 1.0f);
+  nn::Optimizer adam = nn::Optimizer::adam(1e-3f);
+  nn::Scheduler batches(batch);
+
+  batches.run_epoch(net, t, adam);  // sizes every buffer
+  nn::prof::reset();
+  auto start = clock_type::now();
+  batches.run_epoch(net, t, adam);
+  double wall = seconds_since(start);
+
+  nn::prof::print_summary();
+  std::vector<nn::prof::Row> summary = nn::prof::summary();
+
+  bool ok = true;
+  auto check = [&](const char* what, bool pass) {
+    std::printf("%-52s %s\n", what, pass ? "ok" : "FAIL");
+    ok &= pass;
+  };
+
+  // one call per layer per minibatch (Adam: w and b each per layer)
+  const size_t steps = rows / batch;
+  bool counts = true;
+  for (int l = 0; l < 3; ++l) {
+    for (auto [phase, name, per_step] :
+         {std::tuple{P::Forward, "dense", 1},
+          {P::Backward, "activation_grad", 1}, {P::Backward, "bias_grad", 1},
+          {P::Backward, "weight_grad", 1},
+          {P::Backward, "input_grad", l > 0 ? 1 : 0},
+          {P::Backward, "average", 1}, {P::Update, "adam", 2}}) {
+      const nn::prof::Row* r = find(summary, phase, l, name);
+      size_t got = r ? r->calls : 0;
+      if (got != steps * per_step) {
+        std::printf("  %s %s layer %d: %zu calls, expected %zu\n",
+                    nn::prof::phase_name(phase), name, l, got,
+                    steps * per_step);
+        counts = false;
+      }
+    }
+  }
+  const nn::prof::Row* loss = find(summary, P::Backward, 2, "loss");
+  const nn::prof::Row* gather = find(summary, P::Data, -1, "gather_batch");
+  counts &= loss && loss->calls == steps && gather && gather->calls == steps;
+  check("every step recorded once per layer and minibatch", counts);
+
+  uint64_t allocs = 0;
+  double profiled = 0.0;
+  size_t events = 0;
+  for (const auto& r : summary) {
+    allocs += r.allocs;
+    profiled += r.seconds;
+    events += r.calls;
+  }
+  check("no allocations in a warmed-up epoch", allocs == 0);
+  std::printf("profiled steps cover %.1f%% of the epoch's %.1f ms\n",
+              100.0 * profiled / wall, wall * 1e3);
+  check("profiled steps cover at least 90% of the epoch",
+        profiled > 0.9 * wall && profiled <= wall);
+
+  // an allocation inside a scope is charged to it
+  {
+    NN_PROFILE_SCOPE("allocating", -1, P::Other);
+    std::vector<float> v(1000);
+    (void)v;
+  }
+  const nn::prof::Row* allocating =
+      find(nn::prof::summary(), P::Other, -1, "allocating");
+  check("allocations charged to the enclosing scope",
+        allocating && allocating->allocs == 1);
+
+  auto path = std::filesystem::temp_directory_path() / "nn_profile.json";
+  bool written = nn::prof::write_chrome_trace(path);
+  std::ifstream in(path);
+  std::stringstream text;
+  text << in.rdbuf();
+  size_t in_trace = count(text.str(), "\"ph\": \"X\"");
+  std::printf("trace: %s, %zu events\n", path.c_str(), in_trace);
+  check("chrome trace holds every event",
+        written && in_trace == events + 1 &&
+            text.str().rfind("{\"displayTimeUnit\"", 0) == 0);
+
+  // what one scope costs when compiled in
+  const size_t n = 1000000;
+  nn::prof::reset();
+  start = clock_type::now();
+  for (size_t i = 0; i < n; ++i) {
+    NN_PROFILE_SCOPE("empty", -1, P::Other);
+  }
+  double per_scope = seconds_since(start) / n;
+  nn::prof::reset();
+  std::printf("\nempty scope: %.1f ns; %zu scopes per epoch = %.3f%% of it "
+              "(none without NN_PROFILE)\n",
+              per_scope * 1e9, events, 100.0 * per_scope * events / wall);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// nn::QuantizedModel: checks the int8 GEMM paths (AVX512-VNNI, AVX2,
+// scalar) against each other, then compares accuracy and latency of the
+// int8 model with the fp32 forward pass on a random 784-1024-512-10 ReLU /
+// softmax net and on the trained XOR demo network.
+
+using Level = nn::simd::Level;
+
+// every path must give the generic path's int32 results exactly
+static bool check_kernels() {
+  std::mt19937 gen(3);
+  bool ok = true;
+  for (size_t m : {1, 3, 4, 9}) {
+    for (size_t k : {4, 36, 784}) {
+      for (size_t n : {1, 10, 64, 130}) {
+        size_t np = nn::gemm::round_up(n, nn::qgemm::kTile);
+        std::vector<uint8_t> a(m * k);
+        std::vector<int8_t> b(k * np, 0);
+        for (auto& x : a) {
+          x = uint8_t(gen());
+        }
+        for (size_t kk = 0; kk < k; ++kk) {
+          for (size_t j = 0; j < n; ++j) {
+            int v = int(gen() % 255) - 127;
+            b[nn::qgemm::pack_index(kk, j, np)] = int8_t(v);
+          }
+        }
+        std::vector<int32_t> want(m * np), got(m * np);
+        nn::qgemm::run_generic(m, n, k, np, a.data(), k, b.data(),
+                               want.data());
+        for (Level l : {Level::AVX2, Level::AVX512}) {
+          nn::simd::set_level(l);
+          nn::qgemm::run(m, n, k, np, a.data(), k, b.data(), got.data());
+          for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+              if (got[i * np + j] != want[i * np + j]) {
+                std::printf("%zu x %zu x %zu level %d: mismatch FAIL\n", m, k,
+                            n, int(l));
+                ok = false;
+                i = m;
+                break;
+              }
+            }
+          }
+        }
+        nn::simd::set_level(Level::AVX512);
+      }
+    }
+  }
+  std::printf("int8 GEMM paths vs scalar: %s (vnni %s)\n", ok ? "ok" : "FAIL",
+              nn::qgemm::cpu_has_vnni() ? "yes" : "no");
+  return ok;
+}
+
+struct Report {
+  float max_err = 0.0f;  // relative to the largest fp32 output
+  float top1 = 0.0f;     // rows whose argmax agrees
+};
+
+static Report compare(const nn::Matrix& want, const nn::Matrix& got) {
+  Report r;
+  float scale = 0.0f;
+  size_t agree = 0;
+  for (size_t i = 0; i < want.rows; ++i) {
+    size_t a = 0, b = 0;
+    for (size_t j = 0; j < want.cols; ++j) {
+      scale = std::max(scale, std::abs(want(i, j)));
+      r.max_err = std::max(r.max_err, std::abs(want(i, j) - got(i, j)));
+      a = want(i, j) > want(i, a) ? j : a;
+      b = got(i, j) > got(i, b) ? j : b;
+    }
+    agree += a == b;
+  }
+  r.max_err /= scale;
+  r.top1 = float(agree) / want.rows;
+  return r;
+}
+
+static bool mnist_sized() {
+  using A = nn::Activation;
+  nn::NeuralNetwork net(
+      {{784}, {1024, A::Relu}, {512, A::Relu}, {10, A::Softmax}});
+  net.randomize(-0.05f, 0.05f);
+  nn::Matrix calib(256, 784), test(1024, 784);
+  calib.randomize(0.0f, 1.0f);
+  test.randomize(0.0f, 1.0f);
+
+  nn::QuantizedModel q = nn::QuantizedModel::calibrate(net, calib);
+  nn::Matrix want, got;
+  net.infer(test);
+  want = net.get_output();
+  q.predict(test, got);
+  Report r = compare(want, got);
+  size_t params = 0;
+  for (const auto& w : net.ws) {
+    params += w.data.size();
+  }
+  std::printf("\n784-1024-512-10 relu/softmax, 1024 held-out rows\n");
+  std::printf("weights %.1f MB fp32 -> %.1f MB int8 | max err %.2e of max "
+              "output | top-1 agreement %.1f%%\n",
+              params * 4 / 1e6, q.weight_bytes() / 1e6, r.max_err,
+              r.top1 * 100.0f);
+
+  for (size_t batch : {1, 16, 256}) {
+    nn::MatrixView x = test.view().row_range(0, batch);
+    nn::Matrix out;
+    double t32 = time_it([&] { net.infer(x); });
+    std::printf("batch %3zu | fp32 %9.1f us |", batch, t32 * 1e6);
+    for (Level l : {Level::Generic, Level::AVX2, Level::AVX512}) {
+      nn::simd::set_level(l);
+      if (nn::simd::level() != l) {
+        continue;
+      }
+      double t8 = time_it([&] { q.predict(x, out); });
+      const char* path = l == Level::AVX512 && nn::qgemm::cpu_has_vnni()
+                             ? "vnni"
+                             : (l == Level::Generic ? "scalar" : "avx2");
+      std::printf(" %s %9.1f us (%.2fx) |", path, t8 * 1e6, t32 / t8);
+    }
+    nn::simd::set_level(Level::AVX512);
+    std::printf("\n");
+  }
+  return r.top1 > 0.95f && r.max_err < 0.05f;
+}
+
+static bool xor_demo() {
+  nn::Matrix t(4, 3, 0.0f);
+  float data[4][3] = {{0, 0, 0}, {1, 0, 1}, {0, 1, 1}, {1, 1, 0}};
+  for (size_t i = 0; i < 4; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      t(i, j) = data[i][j];
+    }
+  }
+  nn::NeuralNetwork net({2, 4, 1});
+  net.randomize(-2.0f, 2.0f);
+  nn::Optimizer adam = nn::Optimizer::adam(0.05f);
+  nn::Scheduler batches(1);
+  for (size_t epoch = 0; epoch < 2000; ++epoch) {
+    batches.run_epoch(net, t, adam);
+  }
+  nn::QuantizedModel q = nn::QuantizedModel::calibrate(net, t);
+  nn::Matrix got;
+  q.predict(t.view().col_range(0, 2), got);
+  net.infer(t.view().col_range(0, 2));
+  std::printf("\nXOR 2-4-1 after training:\n");
+  bool ok = true;
+  float cost = 0.0f;
+  for (size_t i = 0; i < 4; ++i) {
+    float y = got(i, 0), target = t(i, 2);
+    std::printf("  %g XOR %g -> fp32 %.4f | int8 %.4f\n", t(i, 0), t(i, 1),
+                net.get_output()(i, 0), y);
+    cost += (y - target) * (y - target);
+    ok &= std::abs(y - target) < 0.5f;
+  }
+  std::printf("  cost fp32 %.2e | int8 %.2e %s\n", net.cost(t), cost / 4,
+              ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main() {
+  bool ok = check_kernels();
+  ok &= mnist_sized();
+  ok &= xor_demo();
+  return ok ? 0 : 1;
+}
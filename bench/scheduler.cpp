@@ -0,0 +1,113 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// nn::Scheduler: checks that every epoch visits each row exactly once
+// (shuffled or not, with and without drop_last, batch sizes that do and do
+// not divide the data), that the reported cost matches cost(), and times an
+// epoch against the old backprop + cost() per batch loop.
+
+// column 0 of row i holds i, so the batches say which rows they contain
+static bool covers(size_t rows, size_t batch_size, bool shuffle,
+                   bool drop_last) {
+  nn::Matrix t(rows, 2, 0.0f);
+  for (size_t i = 0; i < rows; ++i) {
+    t(i, 0) = float(i);
+  }
+  nn::Scheduler s(batch_size, shuffle, 42);
+  s.drop_last = drop_last;
+  // a batch larger than the data is one batch of all of it, drop_last or not
+  size_t full = std::min(batch_size, rows);
+  size_t expect = drop_last ? rows / full * full : rows;
+  for (size_t epoch = 0; epoch < 3; ++epoch) {
+    std::vector<int> seen(rows, 0);
+    size_t visited = 0;
+    size_t batches = 0;
+    for (;;) {
+      nn::MatrixView b = s.next(t);
+      ++batches;
+      if (b.rows == 0 || b.rows > batch_size ||
+          (drop_last && b.rows != full)) {
+        return false;
+      }
+      for (size_t i = 0; i < b.rows; ++i) {
+        ++seen[size_t(b.row(i)[0])];
+      }
+      visited += b.rows;
+      if (visited >= expect) {
+        break;
+      }
+    }
+    for (int n : seen) {
+      if (n > 1) {
+        return false;
+      }
+    }
+    if (visited != expect) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  bool ok = true;
+  for (bool shuffle : {false, true}) {
+    for (bool drop_last : {false, true}) {
+      for (size_t batch : {1, 7, 10, 64, 100}) {
+        bool good = covers(100, batch, shuffle, drop_last);
+        if (!good) {
+          std::printf("coverage FAIL: batch %zu shuffle %d drop_last %d\n",
+                      batch, shuffle, drop_last);
+        }
+        ok &= good;
+      }
+    }
+  }
+  ok &= covers(10, 64, true, false);  // batch larger than the data
+  ok &= covers(10, 64, true, true);
+  std::printf("every row once per epoch: %s\n", ok ? "ok" : "FAIL");
+
+  // the epoch cost is the mean of the pre-update losses; with rate 0 that
+  // is just cost(t)
+  nn::NeuralNetwork net({8, 16, 2});
+  net.randomize(-1.0f, 1.0f);
+  nn::Matrix t(1000, 10);
+  t.randomize(0.0f, 1.0f);
+  nn::Scheduler s(64);
+  float got = s.run_epoch(net, t, 0.0f);
+  float want = net.cost(t);
+  bool same = std::abs(got - want) <= 1e-5f * want;
+  std::printf("epoch cost %.6f vs cost() %.6f: %s\n", got, want,
+              same ? "ok" : "FAIL");
+  ok &= same;
+
+  std::printf("\n784-256-128-10, 4096 rows, batch 64\n");
+  nn::NeuralNetwork big({784, 256, 128, 10});
+  big.randomize(-0.1f, 0.1f);
+  nn::Matrix data(4096, 794);
+  data.randomize(0.0f, 1.0f);
+  nn::NeuralNetwork g(big.arch);
+  using clock = std::chrono::steady_clock;
+  auto time = [&](const char* name, auto&& epoch) {
+    epoch();  // warm up
+    auto start = clock::now();
+    epoch();
+    double sec = std::chrono::duration<double>(clock::now() - start).count();
+    std::printf("%-28s | %7.3f s\n", name, sec);
+  };
+  time("backprop + cost() per batch", [&] {
+    for (size_t b = 0; b < data.rows; b += 64) {
+      nn::MatrixView batch = data.view().row_range(b, 64);
+      big.backprop_into(batch, g);
+      big.learn(g, 0.01f);
+      (void)big.cost(batch);
+    }
+  });
+  nn::Scheduler ordered(64, false);
+  time("Scheduler, in order", [&] { ordered.run_epoch(big, data, 0.01f); });
+  nn::Scheduler shuffled(64);
+  time("Scheduler, shuffled", [&] { shuffled.run_epoch(big, data, 0.01f); });
+  return ok ? 0 : 1;
+}
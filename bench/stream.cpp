@@ -0,0 +1,202 @@
+#include "../nn.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+// Streaming data sources: checks that a row file and a CSV file give back
+// exactly the rows that were written, that a malformed CSV row is reported
+// rather than taken for the end of the data and that row file headers
+// claiming more rows than the file holds are rejected, then times one
+// training epoch of 784-256-128-10 from memory, from the row file read
+// inline, and from the row file / CSV through the Prefetcher's background
+// thread.
+
+constexpr size_t kRows = 8192;
+constexpr size_t kCsvRows = 2048;
+constexpr size_t kBatch = 256;
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start) {
+  return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static bool same_rows(nn::DataSource& src, const nn::Matrix& t, size_t n) {
+  nn::Matrix buf;
+  size_t row = 0;
+  for (size_t got; (got = src.read(buf, 100)) > 0; row += got) {
+    for (size_t i = 0; i < got; ++i) {
+      for (size_t j = 0; j < t.cols; ++j) {
+        if (row + i >= n || buf(i, j) != t(row + i, j)) {
+          return false;
+        }
+      }
+    }
+  }
+  return row == n;
+}
+
+// a bad row at the start of the second batch: the first read gets the rows
+// before it, the second reports the line instead of looking like EOF
+static bool reports_bad_row(const std::filesystem::path& path) {
+  {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    std::fprintf(f, "x,y\n");
+    for (int i = 0; i < 8; ++i) {
+      std::fprintf(f, i == 4 ? "%d,oops\n" : "%d,%d\n", i, i);
+    }
+    std::fclose(f);
+  }
+  auto csv = nn::CsvSource::open(path, /*has_header=*/true);
+  if (!csv) {
+    return false;
+  }
+  nn::Matrix buf;
+  bool ok = csv->read(buf, 4) == 4 && !csv->failed();
+  ok = ok && csv->read(buf, 4) == 0 && csv->failed() &&
+       csv->error_line() == 6;
+  ok = ok && csv->read(buf, 4) == 0;  // does not resume past the bad line
+  {
+    nn::Prefetcher batches(*csv, 4);
+    size_t got = 0;
+    for (nn::MatrixView b = batches.next(); b.rows; b = batches.next()) {
+      got += b.rows;
+    }
+    ok = ok && batches.failed() && got == 0;  // still failed: not rewound
+    batches.rewind();
+    got = 0;
+    for (nn::MatrixView b = batches.next(); b.rows; b = batches.next()) {
+      got += b.rows;
+    }
+    ok = ok && batches.failed() && got == 4;
+  }
+  nn::NeuralNetwork net({1, 1}, nn::Activation::Identity);
+  ok = ok && !nn::fit_output_layer(net, *csv);
+  std::filesystem::remove(path);
+  return ok;
+}
+
+// 2^62 rows x 4 cols wraps the byte count to 0, so without the bounds
+// this 64 byte, header-only file would open; 0 cols would allow any rows
+static bool rejects_bad_header(const std::filesystem::path& path) {
+  bool ok = true;
+  for (uint64_t cols : {uint64_t{4}, uint64_t{0}}) {
+    nn::RowFileHeader h{};
+    std::memcpy(h.magic, nn::kRowFileMagic, sizeof(h.magic));
+    h.version = nn::kRowFileVersion;
+    h.rows = uint64_t{1} << 62;
+    h.cols = cols;
+    h.data_offset = nn::kRowFileDataOffset;
+    char buf[nn::kRowFileDataOffset] = {};
+    std::memcpy(buf, &h, sizeof(h));
+    std::ofstream(path, std::ios::binary | std::ios::trunc)
+        .write(buf, sizeof(buf));
+    ok = ok && !nn::RowFileSource::open(path);
+  }
+  std::filesystem::remove(path);
+  return ok;
+}
+
+int main() {
+  nn::Matrix t(kRows, 794, 0.0f);
+  t.randomize(0.0f, 1.0f);
+  auto dir = std::filesystem::temp_directory_path();
+  auto rows_path = dir / "nn_bench_stream.rows";
+  auto csv_path = dir / "nn_bench_stream.csv";
+
+  if (!nn::save_rows(t, rows_path)) {
+    std::printf("could not write %s\n", rows_path.c_str());
+    return 1;
+  }
+  {
+    std::FILE* f = std::fopen(csv_path.c_str(), "w");
+    std::fprintf(f, "header line\n");
+    for (size_t i = 0; i < kCsvRows; ++i) {
+      for (size_t j = 0; j < t.cols; ++j) {
+        std::fprintf(f, j ? ",%.9g" : "%.9g", t(i, j));
+      }
+      std::fprintf(f, "\n");
+    }
+    std::fclose(f);
+  }
+
+  auto rows = nn::RowFileSource::open(rows_path);
+  auto csv = nn::CsvSource::open(csv_path, /*has_header=*/true);
+  bool ok = rows && csv;
+  ok = ok && same_rows(*rows, t, kRows) && same_rows(*csv, t, kCsvRows);
+  std::printf("row file / csv read back: %s\n", ok ? "ok" : "FAIL");
+  bool bad_row = reports_bad_row(dir / "nn_bench_stream_bad.csv");
+  std::printf("malformed csv row reported: %s\n", bad_row ? "ok" : "FAIL");
+  bool bad_header = rejects_bad_header(dir / "nn_bench_stream_bad.rows");
+  std::printf("overflowing row file header rejected: %s\n\n",
+              bad_header ? "ok" : "FAIL");
+  ok = ok && bad_row && bad_header;
+  if (!ok) {
+    return 1;
+  }
+
+  nn::NeuralNetwork init({784, 256, 128, 10}, nn::Activation::Sigmoid);
+  init.randomize(-0.1f, 0.1f);
+  nn::NeuralNetwork g(init.arch);
+
+  {
+    nn::NeuralNetwork net = init;
+    auto start = clock_type::now();
+    for (size_t b = 0; b < kRows; b += kBatch) {
+      net.backprop_into(t.view().row_range(b, kBatch), g);
+      net.learn(g, 0.1f);
+    }
+    std::printf("in memory          | %7.3f s\n", seconds_since(start));
+  }
+  {
+    nn::NeuralNetwork net = init;
+    nn::Matrix batch;
+    rows->rewind();
+    auto start = clock_type::now();
+    while (rows->read(batch, kBatch) > 0) {
+      net.backprop_into(batch, g);
+      net.learn(g, 0.1f);
+    }
+    std::printf("row file, inline   | %7.3f s\n", seconds_since(start));
+  }
+  {
+    nn::NeuralNetwork net = init;
+    rows->rewind();
+    auto start = clock_type::now();
+    nn::Prefetcher batches(*rows, kBatch);
+    for (nn::MatrixView b = batches.next(); b.rows; b = batches.next()) {
+      net.backprop_into(b, g);
+      net.learn(g, 0.1f);
+    }
+    std::printf("row file, prefetch | %7.3f s\n", seconds_since(start));
+  }
+
+  std::printf("\n%zu rows of CSV\n", kCsvRows);
+  {
+    nn::NeuralNetwork net = init;
+    nn::Matrix batch;
+    csv->rewind();
+    auto start = clock_type::now();
+    while (csv->read(batch, kBatch) > 0) {
+      net.backprop_into(batch, g);
+      net.learn(g, 0.1f);
+    }
+    std::printf("csv, inline        | %7.3f s\n", seconds_since(start));
+  }
+  {
+    nn::NeuralNetwork net = init;
+    csv->rewind();
+    auto start = clock_type::now();
+    nn::Prefetcher batches(*csv, kBatch);
+    for (nn::MatrixView b = batches.next(); b.rows; b = batches.next()) {
+      net.backprop_into(b, g);
+      net.learn(g, 0.1f);
+    }
+    std::printf("csv, prefetch      | %7.3f s\n", seconds_since(start));
+  }
+
+  std::filesystem::remove(rows_path);
+  std::filesystem::remove(csv_path);
+  return 0;
+}
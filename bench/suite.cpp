@@ -0,0 +1,288 @@
+#include "../nn.h"
+#include "bench.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The regression suite behind the `bench` build target: times
+// Matrix::dot, transpose, inverse, apply_activation, forward, backprop and
+// a Scheduler epoch over a few sizes and thread counts, and writes one
+// JSON document (to stdout, or --out FILE) for comparing releases.
+//
+//   bench_suite [--out FILE] [--threads 1,2,4] [--min-time SECONDS]
+//               [--filter NAME]
+//
+// Every case reports per-call seconds (median, min, mean over the samples)
+// and a throughput in the unit named by "unit". Cases whose kernel runs on
+// one thread whatever the pool size are run once, with threads = 1, even
+// when --threads leaves 1 out.
+
+struct Options {
+  const char* out = nullptr;
+  std::vector<size_t> threads;
+  double min_time = 0.25;
+  const char* filter = nullptr;
+};
+
+struct Result {
+  std::string bench;  // what is timed, e.g. "dot"
+  std::string size;   // its shape, e.g. "256x256x256"
+  size_t threads = 1;
+  Timing time;        // seconds per call
+  double work = 0.0;  // units per call
+  const char* unit = "";
+};
+
+class Suite {
+ public:
+  explicit Suite(const Options& opt) : opt(opt) {}
+
+  // times f at every thread count (or once at 1 when !threaded)
+  void run(const std::string& bench, const std::string& size, double work,
+           const char* unit, bool threaded, const std::function<void()>& f) {
+    if (opt.filter && bench.find(opt.filter) == std::string::npos) {
+      return;
+    }
+    static const std::vector<size_t> serial = {1};
+    for (size_t t : threaded ? opt.threads : serial) {
+      nn::set_num_threads(t);
+      Result r;
+      r.time = sample(f, opt.min_time);
+      r.bench = bench;
+      r.size = size;
+      r.threads = t;
+      r.work = work;
+      r.unit = unit;
+      std::fprintf(stderr, "%-18s %-18s %3zu threads %12.2f us %10.2f %s\n",
+                   bench.c_str(), size.c_str(), t, r.time.median * 1e6,
+                   work / r.time.median, unit);
+      results.push_back(r);
+    }
+    nn::set_num_threads(0);
+  }
+
+  void write(std::FILE* out) const {
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ",
+                  std::gmtime(&now));
+    const char* levels[] = {"generic", "avx2", "avx512"};
+    std::fprintf(out, "{\n  \"schema\": 1,\n  \"timestamp\": \"%s\",\n", stamp);
+    std::fprintf(out, "  \"compiler\": \"%s\",\n", __VERSION__);
+    std::fprintf(out, "  \"gemm_vector_width\": %zu,\n", nn::gemm::kVecWidth);
+    std::fprintf(out, "  \"simd_level\": \"%s\",\n",
+                 levels[int(nn::simd::level())]);
+    std::fprintf(out, "  \"hardware_threads\": %u,\n",
+                 std::thread::hardware_concurrency());
+    std::fprintf(out, "  \"min_time\": %g,\n  \"results\": [", opt.min_time);
+    for (size_t i = 0; i < results.size(); ++i) {
+      const Result& r = results[i];
+      std::fprintf(out,
+                   "%s\n    {\"bench\": \"%s\", \"size\": \"%s\", "
+                   "\"threads\": %zu, \"calls\": %zu, \"median_s\": %.9g, "
+                   "\"min_s\": %.9g, \"mean_s\": %.9g, \"throughput\": %.6g, "
+                   "\"unit\": \"%s\"}",
+                   i ? "," : "", r.bench.c_str(), r.size.c_str(), r.threads,
+                   r.time.calls, r.time.median, r.time.min, r.time.mean,
+                   r.work / r.time.median, r.unit);
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+  }
+
+ private:
+  const Options& opt;
+  std::vector<Result> results;
+};
+
+static std::string join(const std::vector<size_t>& v, char sep) {
+  std::string s;
+  for (size_t x : v) {
+    if (!s.empty()) {
+      s += sep;
+    }
+    s += std::to_string(x);
+  }
+  return s;
+}
+
+static std::string dims(std::initializer_list<size_t> d) {
+  return join(d, 'x');
+}
+
+static void bench_dot(Suite& s) {
+  const size_t shapes[][3] = {{1, 1024, 1024}, {64, 784, 256},
+                              {256, 256, 256}, {512, 512, 512},
+                              {1024, 1024, 1024}};
+  for (const auto& sh : shapes) {
+    nn::Matrix a(sh[0], sh[1]), b(sh[1], sh[2]), c;
+    a.randomize(-1.0f, 1.0f);
+    b.randomize(-1.0f, 1.0f);
+    s.run("dot", dims({sh[0], sh[1], sh[2]}), 2e-9 * sh[0] * sh[1] * sh[2],
+          "GFLOP/s", true, [&] { nn::Matrix::dot_into(c, a, b); });
+  }
+}
+
+static void bench_transpose(Suite& s) {
+  for (size_t n : {256, 1024, 2048}) {
+    nn::Matrix a(n, n), t;
+    a.randomize(-1.0f, 1.0f);
+    double gb = 2e-9 * n * n * sizeof(float);
+    s.run("transpose_into", dims({n, n}), gb, "GB/s", false,
+          [&] { a.transpose_into(t); });
+    s.run("transpose", dims({n, n}), gb, "GB/s", false, [&] { a.transpose(); });
+  }
+  nn::Matrix tall(16384, 784), t;
+  tall.randomize(-1.0f, 1.0f);
+  s.run("transpose_into", dims({16384, 784}), 2e-9 * tall.data.size() * 4,
+        "GB/s", false, [&] { tall.transpose_into(t); });
+}
+
+static void bench_inverse(Suite& s) {
+  for (size_t n : {64, 256, 512}) {
+    nn::Matrix a(n, n), inv;
+    a.randomize(-1.0f, 1.0f);
+    for (size_t i = 0; i < n; ++i) {
+      a(i, i) += 4.0f;
+    }
+    // LU (2/3 n^3) plus the solve against I (2 n^3)
+    s.run("inverse", dims({n, n}), 1e-9 * (8.0 / 3.0) * n * n * n, "GFLOP/s",
+          true, [&] { inv = a.inverse(); });
+  }
+}
+
+static void bench_activations(Suite& s) {
+  using A = nn::Activation;
+  const std::pair<A, const char*> acts[] = {{A::Sigmoid, "sigmoid"},
+                                            {A::Relu, "relu"},
+                                            {A::Tanh, "tanh"},
+                                            {A::Sin, "sin"},
+                                            {A::Softmax, "softmax"}};
+  nn::Matrix m(1024, 1024);
+  for (const auto& [act, name] : acts) {
+    m.randomize(-4.0f, 4.0f);
+    s.run(std::string("apply_activation/") + name, dims({1024, 1024}),
+          1e-9 * m.data.size(), "Gelem/s", false,
+          [&] { m.apply_activation(act); });
+  }
+}
+
+// rows of inputs followed by one-hot targets
+static nn::Matrix training_data(size_t rows, const std::vector<size_t>& arch) {
+  size_t in = arch.front(), out = arch.back();
+  nn::Matrix t(rows, in + out, 0.0f);
+  for (size_t i = 0; i < rows; ++i) {
+    for (size_t j = 0; j < in; ++j) {
+      t(i, j) = nn::rand_float(0.0f, 1.0f);
+    }
+    t(i, in + i % out) = 1.0f;
+  }
+  return t;
+}
+
+static nn::NeuralNetwork model(const std::vector<size_t>& arch) {
+  using A = nn::Activation;
+  std::vector<nn::NeuralNetwork::Layer> specs = {{arch.front()}};
+  for (size_t l = 1; l + 1 < arch.size(); ++l) {
+    specs.push_back({arch[l], A::Relu});
+  }
+  specs.push_back({arch.back(), A::Softmax});
+  nn::NeuralNetwork net(specs);
+  net.randomize(-0.05f, 0.05f);
+  return net;
+}
+
+static void bench_network(Suite& s, const std::vector<size_t>& arch) {
+  nn::NeuralNetwork net = model(arch);
+  nn::Matrix t = training_data(4096, arch);
+  nn::MatrixView inputs = t.view().col_range(0, arch.front());
+  std::string name = join(arch, '-');
+
+  for (size_t batch : {1, 64, 256}) {
+    nn::MatrixView x = inputs.row_range(0, batch);
+    s.run("forward", name + "/b" + std::to_string(batch), batch, "samples/s",
+          true, [&] { net.forward(x); });
+  }
+  nn::NeuralNetwork g(net.arch);
+  for (size_t batch : {64, 256}) {
+    nn::MatrixView x = t.view().row_range(0, batch);
+    s.run("backprop", name + "/b" + std::to_string(batch), batch, "samples/s",
+          true, [&] { net.backprop_into(x, g); });
+  }
+  // a full epoch of shuffled minibatches with Adam updates
+  nn::Optimizer adam = nn::Optimizer::adam(1e-4f);
+  nn::Scheduler batches(64, true, 1);
+  s.run("epoch", name + "/b64", double(t.rows), "samples/s", true,
+        [&] { batches.run_epoch(net, t, adam); });
+}
+
+static std::vector<size_t> parse_list(const char* s) {
+  std::vector<size_t> v;
+  for (const char* p = s; *p;) {
+    char* end;
+    size_t x = std::strtoul(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    if (x > 0) {
+      v.push_back(x);
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+  return v;
+}
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    bool more = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--out") && more) {
+      opt.out = argv[++i];
+    } else if (!std::strcmp(argv[i], "--threads") && more) {
+      opt.threads = parse_list(argv[++i]);
+    } else if (!std::strcmp(argv[i], "--min-time") && more) {
+      opt.min_time = std::strtod(argv[++i], nullptr);
+    } else if (!std::strcmp(argv[i], "--filter") && more) {
+      opt.filter = argv[++i];
+    } else {
+      std::fprintf(stderr,
+                   "usage: %s [--out FILE] [--threads 1,2,4] "
+                   "[--min-time SECONDS] [--filter NAME]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+  if (opt.threads.empty()) {
+    // 1, 2, 4, ... and the whole machine
+    size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t t = 1; t < hw; t *= 2) {
+      opt.threads.push_back(t);
+    }
+    opt.threads.push_back(hw);
+  }
+
+  Suite suite(opt);
+  bench_dot(suite);
+  bench_transpose(suite);
+  bench_inverse(suite);
+  bench_activations(suite);
+  bench_network(suite, {784, 256, 128, 10});
+  bench_network(suite, {784, 1024, 1024, 10});
+
+  std::FILE* out = opt.out ? std::fopen(opt.out, "w") : stdout;
+  if (!out) {
+    std::fprintf(stderr, "cannot write %s\n", opt.out);
+    return 1;
+  }
+  suite.write(out);
+  if (opt.out) {
+    std::fclose(out);
+    std::fprintf(stderr, "wrote %s\n", opt.out);
+  }
+  return 0;
+}
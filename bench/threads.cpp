@@ -0,0 +1,50 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+// Scaling of Matrix::dot over the shared pool from 1 to N threads.
+// The 1-thread column is the serial path; a speedup above 1.0 marks the
+// shapes where the parallel path wins.
+
+struct Shape {
+  size_t m, k, n;
+};
+
+int main(int argc, char** argv) {
+  size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    max_threads = std::strtoul(argv[1], nullptr, 10);
+  }
+
+  std::vector<Shape> shapes = {{1, 256, 256},    {1, 1024, 1024},
+                               {1, 4096, 4096},  {32, 784, 256},
+                               {128, 128, 128},  {256, 256, 256},
+                               {512, 512, 512},  {1024, 1024, 1024}};
+
+  std::printf("%-22s %8s %10s %10s %8s\n", "shape", "threads", "ms",
+              "GFLOP/s", "speedup");
+  for (const Shape& s : shapes) {
+    nn::Matrix a(s.m, s.k), b(s.k, s.n);
+    a.randomize(-1.0f, 1.0f);
+    b.randomize(-1.0f, 1.0f);
+    nn::Matrix c;
+    double serial = 0.0;
+    char name[64];
+    std::snprintf(name, sizeof(name), "%zux%zu . %zux%zu", s.m, s.k, s.k, s.n);
+    for (size_t t = 1; t <= max_threads; t *= 2) {
+      nn::set_num_threads(t);
+      double sec = time_it([&] { c = nn::Matrix::dot(a, b); });
+      if (t == 1) {
+        serial = sec;
+      }
+      std::printf("%-22s %8zu %10.3f %10.2f %8.2f\n", name, t, sec * 1e3,
+                  2.0 * s.m * s.n * s.k / sec * 1e-9, serial / sec);
+      if (t < max_threads && t * 2 > max_threads) {
+        t = max_threads / 2;  // always finish on max_threads
+      }
+    }
+  }
+  return 0;
+}
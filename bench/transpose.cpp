@@ -0,0 +1,193 @@
+#include "../nn.h"
+#include "bench.h"
+#include <cstdio>
+#include <vector>
+
+// Matrix::transpose / transpose_into: checks the tiled kernels (AVX2 and
+// generic) and the in-place square path against the old scatter loop,
+// times them, checks sgemm's Trans::T operands against transposing first,
+// and times the two products backprop used to materialize a transpose for.
+
+using Level = nn::simd::Level;
+
+// Matrix::transpose as it was: a temporary written a row apart per element
+static void scatter(nn::Matrix& m) {
+  std::vector<float> temp(m.data.size());
+  for (size_t i = 0; i < m.rows; i++) {
+    for (size_t j = 0; j < m.cols; j++) {
+      temp[j * m.rows + i] = m.data[i * m.cols + j];
+    }
+  }
+  m.data = std::move(temp);
+  std::swap(m.rows, m.cols);
+}
+
+static bool same(const nn::Matrix& a, const nn::Matrix& b) {
+  return a.rows == b.rows && a.cols == b.cols && a.data == b.data;
+}
+
+static bool check_transpose() {
+  bool ok = true;
+  for (Level l : {Level::Generic, Level::AVX2}) {
+    nn::simd::set_level(l);
+    if (nn::simd::level() != l) {
+      continue;
+    }
+    size_t bad = 0;
+    for (size_t rows : {1, 7, 8, 9, 64, 65, 130, 257}) {
+      for (size_t cols : {1, 5, 8, 16, 63, 64, 200}) {
+        nn::Matrix m(rows, cols), want = m, got, in_place = m;
+        m.randomize(-1.0f, 1.0f);
+        want = m;
+        scatter(want);
+        m.transpose_into(got);
+        in_place = m;
+        in_place.transpose();
+        bad += !same(got, want) + !same(in_place, want);
+      }
+    }
+    // a strided view: columns [3, 3 + 70) of a 90 x 100 matrix
+    nn::Matrix wide(90, 100), got, want(70, 90);
+    wide.randomize(-1.0f, 1.0f);
+    nn::Matrix::transpose_into(got, wide.view().block(0, 3, 90, 70));
+    for (size_t i = 0; i < 90; ++i) {
+      for (size_t j = 0; j < 70; ++j) {
+        want(j, i) = wide(i, 3 + j);
+      }
+    }
+    bad += !same(got, want);
+    std::printf("%-7s | transpose vs scatter loop: %zu mismatches %s\n",
+                l == Level::Generic ? "generic" : "avx2", bad,
+                bad == 0 ? "ok" : "FAIL");
+    ok &= bad == 0;
+  }
+  nn::simd::set_level(Level::AVX512);
+  return ok;
+}
+
+static void time_transpose(size_t rows, size_t cols) {
+  nn::Matrix m(rows, cols), dst;
+  m.randomize(-1.0f, 1.0f);
+  // read + write of every element
+  double gb = 2.0 * rows * cols * sizeof(float) / 1e9;
+  double t_old = time_it([&] { scatter(m); });
+  double t_into = time_it([&] { m.transpose_into(dst); });
+  double t_self = time_it([&] { m.transpose(); });
+  std::printf("%5zu x %5zu | scatter %7.2f GB/s | transpose_into %7.2f GB/s "
+              "(%5.1fx) | transpose() %7.2f GB/s (%5.1fx)%s\n",
+              rows, cols, gb / t_old, gb / t_into, t_old / t_into,
+              gb / t_self, t_old / t_self,
+              rows == cols ? " in place" : "");
+}
+
+static float max_rel_error(const nn::Matrix& got, const nn::Matrix& want) {
+  float err = 0.0f;
+  for (size_t i = 0; i < got.data.size(); ++i) {
+    float d = std::abs(got.data[i] - want.data[i]);
+    err = std::max(err, d / std::max(1.0f, std::abs(want.data[i])));
+  }
+  return err;
+}
+
+// op(A) . op(B) with each operand stored transposed or not, against the
+// reference loop on explicitly transposed copies; alpha / beta included
+static bool check_gemm() {
+  using nn::Trans;
+  bool ok = true;
+  size_t cases = 0;
+  for (size_t threads : {1, 4}) {
+    nn::set_num_threads(threads);
+    for (size_t m : {1, 3, 6, 7, 100, 300}) {
+      for (size_t n : {1, 10, 33, 260}) {
+        for (size_t k : {1, 17, 256, 300}) {
+          for (Trans ta : {Trans::N, Trans::T}) {
+            for (Trans tb : {Trans::N, Trans::T}) {
+              nn::Matrix a(m, k), b(k, n), c(m, n);
+              a.randomize(-1.0f, 1.0f);
+              b.randomize(-1.0f, 1.0f);
+              c.randomize(-1.0f, 1.0f);
+              nn::Matrix want = nn::Matrix::dot_naive(a, b);
+              for (size_t i = 0; i < want.data.size(); ++i) {
+                want.data[i] = 0.5f * want.data[i] + 2.0f * c.data[i];
+              }
+              nn::Matrix sa = a, sb = b;
+              if (ta == Trans::T) {
+                sa.transpose();
+              }
+              if (tb == Trans::T) {
+                sb.transpose();
+              }
+              nn::sgemm(ta, tb, m, n, k, 0.5f, sa.data.data(), sa.cols,
+                        sb.data.data(), sb.cols, 2.0f, c.data.data(), n);
+              if (max_rel_error(c, want) > 1e-4f) {
+                std::printf("%zu x %zu x %zu ta %d tb %d, %zu threads FAIL\n",
+                            m, n, k, int(ta), int(tb), threads);
+                ok = false;
+              }
+              ++cases;
+            }
+          }
+        }
+      }
+    }
+  }
+  nn::set_num_threads(0);
+  std::printf("sgemm with Trans::T operands: %zu cases %s\n", cases,
+              ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// gW += A^T . dZ and dA = dZ . W^T for a batch-256 layer, transposing into
+// a buffer first (the old backprop) vs reading the transpose in place
+static void time_backprop_products(size_t batch, size_t in, size_t out) {
+  using nn::Trans;
+  nn::Matrix a(batch, in), dz(batch, out), w(in, out), gw(in, out), da;
+  nn::Matrix at, wt;
+  a.randomize(-1.0f, 1.0f);
+  dz.randomize(-1.0f, 1.0f);
+  w.randomize(-1.0f, 1.0f);
+  double t_old_gw = time_it([&] {
+    a.transpose_into(at);
+    nn::sgemm(in, out, batch, 1.0f, at.data.data(), batch, dz.data.data(),
+              out, 1.0f, gw.data.data(), out);
+  });
+  double t_new_gw = time_it([&] {
+    nn::sgemm(Trans::T, Trans::N, in, out, batch, 1.0f, a.data.data(), in,
+              dz.data.data(), out, 1.0f, gw.data.data(), out);
+  });
+  double t_old_da = time_it([&] {
+    w.transpose_into(wt);
+    nn::Matrix::dot_into(da, dz, wt);
+  });
+  da.resize(batch, in);
+  double t_new_da = time_it([&] {
+    nn::sgemm(Trans::N, Trans::T, batch, in, out, 1.0f, dz.data.data(), out,
+              w.data.data(), out, 0.0f, da.data.data(), in);
+  });
+  std::printf("%4zu x %4zu -> %4zu | A^T.dZ: transpose + gemm %8.1f us, "
+              "Trans::T %8.1f us (%.2fx) | dZ.W^T: %8.1f us vs %8.1f us "
+              "(%.2fx)\n",
+              batch, in, out, t_old_gw * 1e6, t_new_gw * 1e6,
+              t_old_gw / t_new_gw, t_old_da * 1e6, t_new_da * 1e6,
+              t_old_da / t_new_da);
+}
+
+int main() {
+  bool ok = check_transpose();
+
+  std::printf("\n");
+  for (size_t n : {256, 1024, 2048, 4096}) {
+    time_transpose(n, n);
+  }
+  time_transpose(1000, 3000);
+  time_transpose(60000, 784);
+
+  std::printf("\n");
+  ok &= check_gemm();
+
+  std::printf("\n%zu threads\n", nn::get_num_threads());
+  time_backprop_products(256, 784, 128);
+  time_backprop_products(256, 1024, 1024);
+  time_backprop_products(32, 4096, 4096);
+  return ok ? 0 : 1;
+}
@@ -1,4 +1,3 @@
-#define NN_ACT nn::Activation::Relu 
 #include "../nn.h"
 #include <iostream>
 #include <vector>
@@ -12,7 +11,8 @@ int main() {
     train.print("training_data");
 
     std::vector<size_t> arch = {1, 1}; 
-    nn::NeuralNetwork nn(arch);
+    // linear output layer: this is plain regression
+    nn::NeuralNetwork nn(arch, nn::Activation::Identity);
     
     nn.randomize(-1.0f, 1.0f);
 
@@ -24,13 +24,13 @@ int main() {
     size_t epochs = 1000;
     float learning_rate = 0.005f; 
 
+    nn::NeuralNetwork gradients(arch);
     for (size_t i = 0; i < epochs; ++i) {
-        nn::NeuralNetwork gradients = nn.backprop(train);
-        
-        nn.learn(gradients, learning_rate);
+        // backprop + learn; the cost comes from the same forward pass
+        float cost = nn.train_step(train, gradients, learning_rate);
 
         if (i % 100 == 0) {
-            std::cout << "Epoch " << i << " | Cost: " << nn.cost(train) << "\n";
+            std::cout << "Epoch " << i << " | Cost: " << cost << "\n";
         }
     }
 
@@ -48,5 +48,14 @@ int main() {
     nn.forward(); 
     std::cout << "Prediction for x=7: " << nn.get_output()(0, 0) << " (Expected: 21)\n";
 
+    // the output layer is linear, so it also has an exact answer: one
+    // least-squares solve instead of the epochs above
+    std::cout << "\n--- Closed form (fit_output_layer) ---\n";
+    nn::NeuralNetwork exact(arch, nn::Activation::Identity);
+    nn::fit_output_layer(exact, train);
+    std::cout << "Weight: " << exact.ws[0](0,0) << "\n";
+    std::cout << "Bias:   " << exact.bs[0](0,0) << "\n";
+    std::cout << "Cost:   " << exact.cost(train) << "\n";
+
     return 0;
 }
@@ -25,24 +25,24 @@ int main()
     
     xor_nn.randomize(-2.0f, 2.0f);
 
-    size_t epochs = 500000;
-    float learning_rate = 0.5f; 
-    const size_t print_every = 1000;
+    // plain SGD (batches.run_epoch(..., 0.5f)) needs around 500000 epochs here
+    size_t epochs = 2000;
+    nn::Optimizer adam = nn::Optimizer::adam(0.05f);
+    const size_t print_every = 100;
 
-    nn::Batch batch;
-    
     size_t batch_size = 1; 
 
+    nn::Scheduler batches(batch_size);
+
     std::cout << "\nTraining started...\n";
 
     for(size_t i = 0 ; i < epochs ; i++){
         
-        do {
-            batch.process(batch_size, xor_nn, train_data, learning_rate);
-        } while (!batch.finished);
+        // mean loss over the epoch's steps, no extra forward pass
+        float cost = batches.run_epoch(xor_nn, train_data, adam);
 
         if (i % print_every == 0) {
-            std::cout << "Epoch " << i << " | Cost: " << xor_nn.cost(train_data) << "\n";
+            std::cout << "Epoch " << i << " | Cost: " << cost << "\n";
         }
     }
 
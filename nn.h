@@ -1,24 +1,56 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <random>
 #include <ranges>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NN_HAS_MMAP 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
 #ifndef NN_RELU_PARAM
 #define NN_RELU_PARAM 0.01f
 #endif
 
+// worker count for the shared pool, 0 = std::thread::hardware_concurrency()
+#ifndef NN_NUM_THREADS
+#define NN_NUM_THREADS 0
+#endif
+
 namespace nn {
 
-enum class Activation { Sigmoid, Relu, Tanh, Sin };
+enum class Activation { Sigmoid, Relu, Tanh, Sin, Identity, Softmax };
 #ifndef NN_ACT
 #define NN_ACT nn::Activation::Sigmoid
 #endif
@@ -28,418 +60,5156 @@ inline float Relu(float x) { return std::max(0.0f, x); }
 inline float Tanh(float x) { return std::tanh(x) ; }
 inline float Sin(float x) { return std::sin(x); }
 
-// Activation Function
-inline float Actf(float x, Activation act = NN_ACT) {
-  switch (act) {
-    case Activation::Sigmoid:
-      return Sigmoid(x);
-    case Activation::Relu:
-      return Relu(x);
-    case Activation::Tanh:
-      return Tanh(x);
-    case Activation::Sin:
-      return Sin(x);
+// Vectorized exp / sigmoid / tanh / sin / cos
+//
+// Cephes-style polynomial approximations written once with GCC/Clang vector
+// extensions and instantiated at three widths: AVX-512 (16 lanes) and
+// AVX2 (8 lanes) through target attributes, and a 4-lane generic build
+// that compiles to SSE2 on x86-64 (or NEON / plain scalar code elsewhere).
+// The widest level the CPU supports is picked at runtime. Against the std::
+// functions the error is a few ulp for exp, sigmoid and tanh, and within
+// 1e-6 absolute for sin/cos on |x| < 8192 (see bench/activations.cpp).
+// Define NN_EXACT_MATH to route everything through the std:: functions.
+namespace simd {
+
+enum class Level { Generic, AVX2, AVX512 };
+
+inline Level detect_level() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return Level::AVX512;
   }
-  assert(false && "unreachable");
-  return 0.0f;
+  if (__builtin_cpu_supports("avx2")) {
+    return Level::AVX2;
+  }
+#endif
+  return Level::Generic;
 }
 
-// Derivative of the Activation Function
-// y = activated output, z = pre-activation input
-inline float Dactf(float y, float z, Activation dact = NN_ACT) {
-  switch (dact) {
-    case Activation::Sigmoid:
-      return y * (1.0f - y);
-    case Activation::Relu:
-      return z > 0 ? 1.0f : NN_RELU_PARAM;
-    case Activation::Tanh:
-      return 1.0f - y * y;
-    case Activation::Sin:
-      return std::cos(z);
+inline Level& level_ref() {
+  static Level level = detect_level();
+  return level;
+}
+
+inline Level level() { return level_ref(); }
+
+// caps the level in use (benchmarks compare paths); never goes above what
+// the CPU supports
+inline void set_level(Level l) { level_ref() = std::min(l, detect_level()); }
+
+#define NN_ALWAYS_INLINE inline __attribute__((always_inline))
+// for loops over register arrays: -O2 does not always unroll them fully,
+// and an array indexed by a loop variable stays in memory
+#define NN_UNROLL _Pragma("GCC unroll 16")
+
+// Everything below works on vectors in place through references: the wide
+// instantiations are only ever inlined into the target("avx2") /
+// target("avx512f") entry points, and passing them by value from a
+// function without those targets is an ABI change GCC warns about.
+template <size_t W>
+struct Vec {
+  typedef float f __attribute__((vector_size(W * sizeof(float))));
+  typedef int32_t i __attribute__((vector_size(W * sizeof(float))));
+  typedef uint32_t u __attribute__((vector_size(W * sizeof(float))));
+  typedef uint16_t h __attribute__((vector_size(W * sizeof(uint16_t))));
+};
+
+// x = mask ? a : x, lane by lane
+template <typename F, typename I>
+NN_ALWAYS_INLINE void blend(F& x, const I& mask, const F& a) {
+  x = (F)(((I)a & mask) | ((I)x & ~mask));
+}
+
+template <typename F, typename I>
+NN_ALWAYS_INLINE void exp(F& x) {
+  const float hi = 88.3762626647949f;
+  blend<F, I>(x, x > hi, F{} + hi);
+  blend<F, I>(x, x < -hi, F{} - hi);
+
+  // x = n * ln2 + r, |r| <= ln2 / 2
+  F fx = x * 1.44269504088896341f + 0.5f;
+  F tmp = __builtin_convertvector(__builtin_convertvector(fx, I), F);
+  fx = tmp - (F)((I)(F{} + 1.0f) & (tmp > fx));  // floor
+  F r = x - fx * 0.693359375f - fx * -2.12194440e-4f;
+
+  F z = r * r;
+  F y = F{} + 1.9875691500E-4f;
+  y = y * r + 1.3981999507E-3f;
+  y = y * r + 8.3334519073E-3f;
+  y = y * r + 4.1665795894E-2f;
+  y = y * r + 1.6666665459E-1f;
+  y = y * r + 5.0000001201E-1f;
+  y = y * z + r + 1.0f;
+
+  // times 2^n by building the exponent directly
+  I n = (__builtin_convertvector(fx, I) + 127) << 23;
+  x = y * (F)n;
+}
+
+template <typename F, typename I>
+NN_ALWAYS_INLINE void sigmoid(F& x) {
+  x = -x;
+  exp<F, I>(x);
+  x = 1.0f / (1.0f + x);
+}
+
+template <typename F, typename I>
+NN_ALWAYS_INLINE void tanh(F& x) {
+  F ax = (F)((I)x & 0x7fffffff);
+
+  // odd polynomial near zero, where 1 - 2 / (e^2x + 1) cancels badly
+  F z = x * x;
+  F p = F{} - 5.70498872745E-3f;
+  p = p * z + 2.06390887954E-2f;
+  p = p * z - 5.37397155531E-2f;
+  p = p * z + 1.33314422036E-1f;
+  p = p * z - 3.33332819422E-1f;
+  F small = p * z * x + x;
+
+  F e = ax + ax;
+  exp<F, I>(e);
+  F large = 1.0f - 2.0f / (e + 1.0f);
+  large = (F)((I)large | ((I)x & (int32_t)0x80000000));  // copysign
+
+  x = large;
+  blend<F, I>(x, ax < 0.625f, small);
+}
+
+// shared by sin and cos: reduces |x| into [-pi/4, pi/4] around j * pi/4
+// (j even) and evaluates both polynomials
+template <typename F, typename I>
+NN_ALWAYS_INLINE void sincos_reduce(const F& x, I& j, F& sin_poly,
+                                    F& cos_poly) {
+  F ax = (F)((I)x & 0x7fffffff);
+  F y = ax * 1.27323954473516f;  // 4 / pi
+  j = __builtin_convertvector(y, I);
+  j = (j + 1) & ~1;
+  y = __builtin_convertvector(j, F);
+
+  // extended precision modular arithmetic
+  F r = ((ax - y * 0.78515625f) - y * 2.4187564849853515625e-4f) -
+        y * 3.77489497744594108e-8f;
+  F z = r * r;
+
+  F c = F{} + 2.443315711809948E-005f;
+  c = c * z - 1.388731625493765E-003f;
+  c = c * z + 4.166664568298827E-002f;
+  cos_poly = c * z * z - 0.5f * z + 1.0f;
+
+  F s = F{} - 1.9515295891E-4f;
+  s = s * z + 8.3321608736E-3f;
+  s = s * z - 1.6666654611E-1f;
+  sin_poly = s * z * r + r;
+}
+
+template <typename F, typename I>
+NN_ALWAYS_INLINE void sin(F& x) {
+  I j;
+  F sp, cp;
+  sincos_reduce<F, I>(x, j, sp, cp);
+  I sign = ((I)x & (int32_t)0x80000000) ^ ((j & 4) << 29);
+  x = cp;
+  blend<F, I>(x, (j & 2) == 0, sp);
+  x = (F)((I)x ^ sign);
+}
+
+template <typename F, typename I>
+NN_ALWAYS_INLINE void cos(F& x) {
+  I j;
+  F sp, cp;
+  sincos_reduce<F, I>(x, j, sp, cp);
+  j -= 2;
+  I sign = (~j & 4) << 29;
+  x = cp;
+  blend<F, I>(x, (j & 2) == 0, sp);
+  x = (F)((I)x ^ sign);
+}
+
+// x = sqrt(x) for x >= 0: bit-trick 1/sqrt estimate, three Newton steps
+// (about 1 ulp), times x. x == 0 gives 0.
+template <typename F, typename I>
+NN_ALWAYS_INLINE void sqrt(F& x) {
+  F y = (F)(0x5f375a86 - ((I)x >> 1));
+  F h = x * 0.5f;
+  y = y * (1.5f - h * y * y);
+  y = y * (1.5f - h * y * y);
+  y = y * (1.5f - h * y * y);
+  x = x * y;
+}
+
+enum class Op { Exp, Sigmoid, Tanh, Sin, Cos };
+
+template <Op op, typename F, typename I>
+NN_ALWAYS_INLINE void apply(F& x) {
+  if constexpr (op == Op::Exp) {
+    exp<F, I>(x);
+  } else if constexpr (op == Op::Sigmoid) {
+    sigmoid<F, I>(x);
+  } else if constexpr (op == Op::Tanh) {
+    tanh<F, I>(x);
+  } else if constexpr (op == Op::Sin) {
+    sin<F, I>(x);
+  } else {
+    cos<F, I>(x);
   }
-  assert(false && "Unreachable");
-  return 0.0f;
 }
 
-inline float rand_float(float low, float high) {
-  static std::mt19937 gen(std::random_device{}());
-  std::uniform_real_distribution<float> dist(low, high);
-  return dist(gen);
+// x[i] = op(x[i]), W lanes at a time; the tail goes through a padded vector
+template <Op op, size_t W>
+NN_ALWAYS_INLINE void map(float* x, size_t n) {
+  using F = typename Vec<W>::f;
+  using I = typename Vec<W>::i;
+  size_t i = 0;
+  for (; i + W <= n; i += W) {
+    F v;
+    std::memcpy(&v, x + i, sizeof(v));
+    apply<op, F, I>(v);
+    std::memcpy(x + i, &v, sizeof(v));
+  }
+  if (i < n) {
+    float tail[W] = {};
+    for (size_t k = 0; k < n - i; ++k) {
+      tail[k] = x[i + k];
+    }
+    F v;
+    std::memcpy(&v, tail, sizeof(v));
+    apply<op, F, I>(v);
+    std::memcpy(tail, &v, sizeof(v));
+    for (size_t k = 0; k < n - i; ++k) {
+      x[i + k] = tail[k];
+    }
+  }
 }
 
-class Matrix {
- public:
-  size_t rows;
-  size_t cols;
-  std::vector<float> data;
+template <Op op>
+void map_generic(float* x, size_t n) {
+  map<op, 4>(x, n);
+}
 
-  Matrix(size_t r = 0, size_t c = 0, float d = 0.0f)
-      : rows(r), cols(c), data(r * c, d) {}
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+template <Op op>
+__attribute__((target("avx2,fma"))) void map_avx2(float* x, size_t n) {
+  map<op, 8>(x, n);
+}
 
-  float& operator()(size_t i, size_t j) {
-    assert(i < this->rows && j < this->cols);
-    return this->data[i * cols + j];
+template <Op op>
+__attribute__((target("avx512f"))) void map_avx512(float* x, size_t n) {
+  map<op, 16>(x, n);
+}
+#endif
+
+template <Op op>
+float exact(float x) {
+  if constexpr (op == Op::Exp) {
+    return std::exp(x);
+  } else if constexpr (op == Op::Sigmoid) {
+    return Sigmoid(x);
+  } else if constexpr (op == Op::Tanh) {
+    return std::tanh(x);
+  } else if constexpr (op == Op::Sin) {
+    return std::sin(x);
+  } else {
+    return std::cos(x);
   }
+}
 
-  // const one for reading only;
-  const float& operator()(size_t i, size_t j) const {
-    assert(i < rows && j < cols);
-    return data[i * cols + j];
+template <Op op>
+void run(float* x, size_t n) {
+#ifdef NN_EXACT_MATH
+  for (size_t i = 0; i < n; ++i) {
+    x[i] = exact<op>(x[i]);
+  }
+#else
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  // arrays shorter than one wide vector are cheaper on the narrow path
+  Level l = level();
+  if (l == Level::AVX512 && n >= 16) {
+    return map_avx512<op>(x, n);
   }
+  if (l >= Level::AVX2 && n >= 8) {
+    return map_avx2<op>(x, n);
+  }
+#endif
+  map_generic<op>(x, n);
+#endif
+}
 
-  void fill(float x) { std::fill(data.begin(), data.end(), x); }
+inline void exp(float* x, size_t n) { run<Op::Exp>(x, n); }
+inline void sigmoid(float* x, size_t n) { run<Op::Sigmoid>(x, n); }
+inline void tanh(float* x, size_t n) { run<Op::Tanh>(x, n); }
+inline void sin(float* x, size_t n) { run<Op::Sin>(x, n); }
+inline void cos(float* x, size_t n) { run<Op::Cos>(x, n); }
 
-  void randomize(float low, float high) {
-    for (auto& d : data) {
-      d = rand_float(low, high);
+}  // namespace simd
+
+// Reduced-precision storage
+//
+// bf16 is the top half of an fp32 (8-bit exponent, 7-bit mantissa): the
+// same range with about 3 significant digits. fp16 is IEEE binary16 (5-bit
+// exponent, 10-bit mantissa): more digits, but |x| > 65504 becomes inf and
+// |x| < 6.1e-5 loses precision. Both are storage formats only; values are
+// widened to fp32 before any arithmetic. Narrowing rounds to nearest even.
+struct bf16 {
+  uint16_t bits;
+};
+
+struct fp16 {
+  uint16_t bits;
+};
+
+enum class Precision { F32, BF16, FP16 };
+
+namespace half {
+
+// portable scalar conversions, bit-exact with the hardware paths below
+// (except that AVX512-BF16 flushes fp32 denormals to zero)
+inline float to_float(bf16 h) {
+  uint32_t x = uint32_t(h.bits) << 16;
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+inline bf16 to_bf16(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  if ((x & 0x7fffffffu) > 0x7f800000u) {
+    return {uint16_t((x >> 16) | 0x40)};  // keep NaNs NaN (quiet)
+  }
+  x += 0x7fffu + ((x >> 16) & 1);
+  return {uint16_t(x >> 16)};
+}
+
+inline float to_float(fp16 h) {
+  uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+  uint32_t e = (h.bits >> 10) & 0x1f;
+  uint32_t m = h.bits & 0x3ff;
+  uint32_t x;
+  if (e == 0x1f) {
+    // NaNs come out quiet, as VCVTPH2PS makes them
+    x = sign | 0x7f800000u | (m ? 0x400000u : 0) | (m << 13);
+  } else if (e != 0) {
+    x = sign | ((e + 112) << 23) | (m << 13);
+  } else {
+    // zero or subnormal: m * 2^-24 is exact in fp32
+    float f = float(m) * 0x1p-24f;
+    std::memcpy(&x, &f, sizeof(x));
+    x |= sign;
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+inline fp16 to_fp16(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  uint16_t sign = uint16_t((x >> 16) & 0x8000);
+  uint32_t a = x & 0x7fffffffu;
+  if (a > 0x7f800000u) {
+    return {uint16_t(sign | 0x7e00 | ((a >> 13) & 0x3ff))};
+  }
+  if (a >= 0x477ff000u) {  // rounds to more than 65504: inf
+    return {uint16_t(sign | 0x7c00)};
+  }
+  uint32_t h, rest, halfway;
+  if (a >= 0x38800000u) {  // normal: rebias the exponent from 127 to 15
+    h = (a - 0x38000000u) >> 13;
+    rest = a & 0x1fff;
+    halfway = 0x1000;
+  } else {
+    // subnormal: h counts units of 2^-24
+    uint32_t e = a >> 23;
+    if (e < 102) {
+      return {sign};
     }
+    uint32_t m = (a & 0x7fffff) | 0x800000;
+    uint32_t shift = 126 - e;
+    h = m >> shift;
+    rest = m & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  }
+  if (rest > halfway || (rest == halfway && (h & 1))) {
+    ++h;  // may carry into the exponent, which is still the right value
   }
+  return {uint16_t(sign | h)};
+}
 
-  void apply_activation(Activation act) {
-    for (auto& d : data) {
-      d = Actf(d, act);
+// W lanes at a time with GCC vector extensions: bf16 is a shift and an
+// integer rounding step, so it vectorizes without special instructions
+template <size_t W>
+NN_ALWAYS_INLINE void widen_bf16(const bf16* src, float* dst, size_t n) {
+  using H = typename simd::Vec<W>::h;
+  using U = typename simd::Vec<W>::u;
+  size_t i = 0;
+  for (; i + W <= n; i += W) {
+    H h;
+    std::memcpy(&h, src + i, sizeof(h));
+    U x = __builtin_convertvector(h, U) << 16;
+    std::memcpy(dst + i, &x, sizeof(x));
+  }
+  for (size_t t = 0; t < n - i; ++t) {
+    dst[i + t] = to_float(src[i + t]);
+  }
+}
+
+template <size_t W>
+NN_ALWAYS_INLINE void narrow_bf16(const float* src, bf16* dst, size_t n) {
+  using H = typename simd::Vec<W>::h;
+  using U = typename simd::Vec<W>::u;
+  size_t i = 0;
+  for (; i + W <= n; i += W) {
+    U x;
+    std::memcpy(&x, src + i, sizeof(x));
+    U r = (x + 0x7fffu + ((x >> 16) & 1)) >> 16;
+    U nan = (U)((x & 0x7fffffffu) > 0x7f800000u);
+    r = (((x >> 16) | 0x40) & nan) | (r & ~nan);
+    H h = __builtin_convertvector(r, H);
+    std::memcpy(dst + i, &h, sizeof(h));
+  }
+  for (size_t t = 0; t < n - i; ++t) {
+    dst[i + t] = to_bf16(src[i + t]);
+  }
+}
+
+inline void widen_generic(const bf16* src, float* dst, size_t n) {
+  widen_bf16<4>(src, dst, n);
+}
+
+inline void narrow_generic(const float* src, bf16* dst, size_t n) {
+  narrow_bf16<4>(src, dst, n);
+}
+
+inline void widen_generic(const fp16* src, float* dst, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = to_float(src[i]);
+  }
+}
+
+inline void narrow_generic(const float* src, fp16* dst, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = to_fp16(src[i]);
+  }
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+inline bool cpu_has_f16c() {
+  static bool has = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("f16c") != 0;
+  }();
+  return has;
+}
+
+inline bool cpu_has_avx512bf16() {
+  static bool has = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512bf16") != 0;
+  }();
+  return has;
+}
+
+__attribute__((target("avx2"))) inline void widen_avx2(const bf16* src,
+                                                       float* dst, size_t n) {
+  widen_bf16<8>(src, dst, n);
+}
+
+__attribute__((target("avx512f"))) inline void widen_avx512(const bf16* src,
+                                                           float* dst,
+                                                           size_t n) {
+  widen_bf16<16>(src, dst, n);
+}
+
+__attribute__((target("avx2"))) inline void narrow_avx2(const float* src,
+                                                       bf16* dst, size_t n) {
+  narrow_bf16<8>(src, dst, n);
+}
+
+// VCVTNEPS2BF16: 16 lanes per instruction
+__attribute__((target("avx512f,avx512bf16"))) inline void narrow_avx512bf16(
+    const float* src, bf16* dst, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), (__m256i)h);
+  }
+  for (size_t t = 0; t < n - i; ++t) {
+    dst[i + t] = to_bf16(src[i + t]);
+  }
+}
+
+// VCVTPH2PS / VCVTPS2PH: 8 lanes per instruction
+__attribute__((target("avx2,f16c"))) inline void widen_f16c(const fp16* src,
+                                                           float* dst,
+                                                           size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+  for (size_t t = 0; t < n - i; ++t) {
+    dst[i + t] = to_float(src[i + t]);
+  }
+}
+
+__attribute__((target("avx2,f16c"))) inline void narrow_f16c(const float* src,
+                                                            fp16* dst,
+                                                            size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+  for (size_t t = 0; t < n - i; ++t) {
+    dst[i + t] = to_fp16(src[i + t]);
+  }
+}
+#endif
+
+}  // namespace half
+
+// dst[i] = src[i] widened or narrowed, on the best path the CPU has (capped
+// by simd::set_level, which is how the benchmarks compare them)
+inline void convert(const bf16* src, float* dst, size_t n) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  simd::Level l = simd::level();
+  if (l == simd::Level::AVX512) {
+    return half::widen_avx512(src, dst, n);
+  }
+  if (l == simd::Level::AVX2) {
+    return half::widen_avx2(src, dst, n);
+  }
+#endif
+  half::widen_generic(src, dst, n);
+}
+
+inline void convert(const float* src, bf16* dst, size_t n) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  simd::Level l = simd::level();
+  if (l == simd::Level::AVX512 && half::cpu_has_avx512bf16()) {
+    return half::narrow_avx512bf16(src, dst, n);
+  }
+  if (l >= simd::Level::AVX2) {
+    return half::narrow_avx2(src, dst, n);
+  }
+#endif
+  half::narrow_generic(src, dst, n);
+}
+
+inline void convert(const fp16* src, float* dst, size_t n) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  if (simd::level() >= simd::Level::AVX2 && half::cpu_has_f16c()) {
+    return half::widen_f16c(src, dst, n);
+  }
+#endif
+  half::widen_generic(src, dst, n);
+}
+
+inline void convert(const float* src, fp16* dst, size_t n) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  if (simd::level() >= simd::Level::AVX2 && half::cpu_has_f16c()) {
+    return half::narrow_f16c(src, dst, n);
+  }
+#endif
+  half::narrow_generic(src, dst, n);
+}
+
+inline void convert(const float* src, float* dst, size_t n) {
+  std::copy(src, src + n, dst);
+}
+
+// Transpose kernels used by Matrix::transpose / transpose_into
+//
+// dst = src^T walked in blocks of 256 source rows by 64 columns, 8 x 8
+// tiles at a time: each destination row of a block is written 1 KB in a
+// row, while the 64 KB of source it is read from stays in L2. A tile
+// is eight row loads, three rounds of two-input shuffles and eight row
+// stores (vunpck / vshufps / vperm2f128 on AVX) rather than 64 writes each
+// a row apart. Square matrices are transposed in place by swapping mirrored
+// tiles, 64 x 64 blocks at a time. Written with vector extensions like
+// simd::, so the same code is built for AVX2 through a target attribute
+// and for the generic level.
+namespace xpose {
+
+constexpr size_t kTile = 8;
+constexpr size_t kBlockRows = 256;
+constexpr size_t kBlockCols = 64;
+
+typedef float v8 __attribute__((vector_size(kTile * sizeof(float))));
+typedef int32_t i8 __attribute__((vector_size(kTile * sizeof(int32_t))));
+
+// loads the tile at src into r[0..8), transposed
+NN_ALWAYS_INLINE void load_tile(const float* src, size_t lds, v8* r) {
+  v8 t[kTile];
+  NN_UNROLL
+  for (size_t i = 0; i < kTile; ++i) {
+    std::memcpy(&r[i], src + i * lds, sizeof(v8));
+  }
+  // interleave row pairs, then pairs of pairs, then the 128-bit halves
+  NN_UNROLL
+  for (size_t i = 0; i < kTile; i += 2) {
+    t[i] = __builtin_shuffle(r[i], r[i + 1], i8{0, 8, 1, 9, 4, 12, 5, 13});
+    t[i + 1] =
+        __builtin_shuffle(r[i], r[i + 1], i8{2, 10, 3, 11, 6, 14, 7, 15});
+  }
+  NN_UNROLL
+  for (size_t h = 0; h < kTile; h += 4) {
+    r[h] = __builtin_shuffle(t[h], t[h + 2], i8{0, 1, 8, 9, 4, 5, 12, 13});
+    r[h + 1] =
+        __builtin_shuffle(t[h], t[h + 2], i8{2, 3, 10, 11, 6, 7, 14, 15});
+    r[h + 2] =
+        __builtin_shuffle(t[h + 1], t[h + 3], i8{0, 1, 8, 9, 4, 5, 12, 13});
+    r[h + 3] =
+        __builtin_shuffle(t[h + 1], t[h + 3], i8{2, 3, 10, 11, 6, 7, 14, 15});
+  }
+  NN_UNROLL
+  for (size_t i = 0; i < 4; ++i) {
+    t[i] = __builtin_shuffle(r[i], r[i + 4], i8{0, 1, 2, 3, 8, 9, 10, 11});
+    t[i + 4] =
+        __builtin_shuffle(r[i], r[i + 4], i8{4, 5, 6, 7, 12, 13, 14, 15});
+  }
+  NN_UNROLL
+  for (size_t i = 0; i < kTile; ++i) {
+    r[i] = t[i];
+  }
+}
+
+NN_ALWAYS_INLINE void store_tile(float* dst, size_t ldd, const v8* r) {
+  NN_UNROLL
+  for (size_t i = 0; i < kTile; ++i) {
+    std::memcpy(dst + i * ldd, &r[i], sizeof(v8));
+  }
+}
+
+// a partial tile at the right / bottom edge
+inline void edge(size_t rows, size_t cols, const float* src, size_t lds,
+                 float* dst, size_t ldd) {
+  for (size_t i = 0; i < rows; ++i) {
+    for (size_t j = 0; j < cols; ++j) {
+      dst[j * ldd + i] = src[i * lds + j];
     }
   }
+}
 
-  Matrix& operator+=(const Matrix& other) {
-    assert(other.cols == cols && rows == other.rows);
-    for (size_t i = 0; i < data.size(); i++) {
-      data[i] = data[i] + other.data[i];
+// the tile at (i, j), or what is left of it inside rows x cols
+NN_ALWAYS_INLINE void copy_tile(size_t rows, size_t cols, size_t i, size_t j,
+                                const float* src, size_t lds, float* dst,
+                                size_t ldd) {
+  const float* s = src + i * lds + j;
+  float* d = dst + j * ldd + i;
+  if (i + kTile <= rows && j + kTile <= cols) {
+    v8 r[kTile];
+    load_tile(s, lds, r);
+    store_tile(d, ldd, r);
+  } else {
+    edge(std::min(kTile, rows - i), std::min(kTile, cols - j), s, lds, d, ldd);
+  }
+}
+
+NN_ALWAYS_INLINE void copy_blocks(size_t rows, size_t cols, const float* src,
+                                  size_t lds, float* dst, size_t ldd) {
+  for (size_t ib = 0; ib < rows; ib += kBlockRows) {
+    size_t ie = std::min(rows, ib + kBlockRows);
+    for (size_t jb = 0; jb < cols; jb += kBlockCols) {
+      size_t je = std::min(cols, jb + kBlockCols);
+      for (size_t j = jb; j < je; j += kTile) {
+        for (size_t i = ib; i < ie; i += kTile) {
+          copy_tile(ie, je, i, j, src, lds, dst, ldd);
+        }
+      }
     }
+  }
+}
 
-    return *this;
+NN_ALWAYS_INLINE void square_blocks(size_t n, float* a, size_t lda) {
+  size_t whole = n / kTile * kTile;
+  for (size_t ib = 0; ib < whole; ib += kBlockCols) {
+    size_t ie = std::min(whole, ib + kBlockCols);
+    for (size_t jb = ib; jb < whole; jb += kBlockCols) {
+      size_t je = std::min(whole, jb + kBlockCols);
+      for (size_t i = ib; i < ie; i += kTile) {
+        for (size_t j = std::max(jb, i); j < je; j += kTile) {
+          v8 x[kTile], y[kTile];
+          load_tile(a + i * lda + j, lda, x);
+          if (i == j) {
+            store_tile(a + i * lda + j, lda, x);
+            continue;
+          }
+          load_tile(a + j * lda + i, lda, y);
+          store_tile(a + j * lda + i, lda, x);
+          store_tile(a + i * lda + j, lda, y);
+        }
+      }
+    }
+  }
+  // pairs with an index in the last partial tile
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = std::max(i + 1, whole); j < n; ++j) {
+      std::swap(a[i * lda + j], a[j * lda + i]);
+    }
   }
+}
 
-  Matrix& operator*=(float scale) {
-    assert(cols * rows == data.size());
-    for (auto& d : data) {
-      d *= scale;
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+__attribute__((target("avx2"))) inline void copy_avx2(size_t rows,
+                                                      size_t cols,
+                                                      const float* src,
+                                                      size_t lds, float* dst,
+                                                      size_t ldd) {
+  copy_blocks(rows, cols, src, lds, dst, ldd);
+}
+
+__attribute__((target("avx2"))) inline void square_avx2(size_t n, float* a,
+                                                        size_t lda) {
+  square_blocks(n, a, lda);
+}
+#endif
+
+inline void copy_generic(size_t rows, size_t cols, const float* src,
+                         size_t lds, float* dst, size_t ldd) {
+  copy_blocks(rows, cols, src, lds, dst, ldd);
+}
+
+inline void square_generic(size_t n, float* a, size_t lda) {
+  square_blocks(n, a, lda);
+}
+
+// dst (cols x rows, leading dimension ldd) = src (rows x cols)^T
+inline void copy(size_t rows, size_t cols, const float* src, size_t lds,
+                 float* dst, size_t ldd) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  if (simd::level() >= simd::Level::AVX2) {
+    return copy_avx2(rows, cols, src, lds, dst, ldd);
+  }
+#endif
+  copy_generic(rows, cols, src, lds, dst, ldd);
+}
+
+// a (n x n) = a^T in place
+inline void square(size_t n, float* a, size_t lda) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  if (simd::level() >= simd::Level::AVX2) {
+    return square_avx2(n, a, lda);
+  }
+#endif
+  square_generic(n, a, lda);
+}
+
+}  // namespace xpose
+
+// Activation policies
+//
+// Each policy carries the function and its derivative as static members so
+// loops templated on it inline to straight-line, branch-free code. A
+// runtime Activation is turned into a policy once per call with
+// with_activation() instead of once per element. Policies may also provide
+// whole-array f_n / df_n, which the loops below prefer (the SIMD kernels),
+// or row-wise f_rows / df_rows for activations that mix a row's elements.
+struct SigmoidAct {
+  static float f(float x) { return Sigmoid(x); }
+  static void f_n(float* x, size_t n) { simd::sigmoid(x, n); }
+  // y = activated output, z = pre-activation input
+  static float df(float y, float) { return y * (1.0f - y); }
+};
+
+struct ReluAct {
+  static float f(float x) { return Relu(x); }
+  static float df(float, float z) { return z > 0 ? 1.0f : NN_RELU_PARAM; }
+};
+
+struct TanhAct {
+  static float f(float x) { return Tanh(x); }
+  static void f_n(float* x, size_t n) { simd::tanh(x, n); }
+  static float df(float y, float) { return 1.0f - y * y; }
+};
+
+struct SinAct {
+  static float f(float x) { return Sin(x); }
+  static void f_n(float* x, size_t n) { simd::sin(x, n); }
+  static float df(float, float z) { return std::cos(z); }
+  static void df_n(float* dz, const float* da, const float*, const float* z,
+                   float s, size_t n) {
+    std::copy(z, z + n, dz);
+    simd::cos(dz, n);
+    for (size_t i = 0; i < n; ++i) {
+      dz[i] = s * da[i] * dz[i];
+    }
+  }
+};
+
+struct IdentityAct {
+  static float f(float x) { return x; }
+  static void f_n(float*, size_t) {}
+  static float df(float, float) { return 1.0f; }
+};
+
+// Softmax over each row. As a scalar f/df it degenerates to a one-element
+// row and the diagonal of the Jacobian, which is all Actf/Dactf can mean.
+struct SoftmaxAct {
+  static float f(float) { return 1.0f; }
+  static float df(float y, float) { return y * (1.0f - y); }
+
+  static void f_rows(float* x, size_t rows, size_t cols) {
+    for (size_t i = 0; i < rows; ++i) {
+      float* row = x + i * cols;
+      float mx = *std::max_element(row, row + cols);
+      for (size_t j = 0; j < cols; ++j) {
+        row[j] -= mx;
+      }
+      simd::exp(row, cols);
+      float sum = 0.0f;
+      for (size_t j = 0; j < cols; ++j) {
+        sum += row[j];
+      }
+      float inv = 1.0f / sum;
+      for (size_t j = 0; j < cols; ++j) {
+        row[j] *= inv;
+      }
+    }
+  }
+
+  // dz = s * J^T da with J = diag(y) - y y^T, i.e.
+  // dz_j = s * y_j * (da_j - sum_k da_k y_k)
+  static void df_rows(float* dz, const float* da, const float* y,
+                      const float*, float s, size_t rows, size_t cols) {
+    for (size_t i = 0; i < rows; ++i) {
+      const float* yr = y + i * cols;
+      const float* dar = da + i * cols;
+      float dot = 0.0f;
+      for (size_t j = 0; j < cols; ++j) {
+        dot += dar[j] * yr[j];
+      }
+      float* dzr = dz + i * cols;
+      for (size_t j = 0; j < cols; ++j) {
+        dzr[j] = s * yr[j] * (dar[j] - dot);
+      }
+    }
+  }
+};
+
+// calls fn(Policy{}) for the policy matching act
+template <typename F>
+decltype(auto) with_activation(Activation act, F&& fn) {
+  switch (act) {
+    case Activation::Sigmoid:
+      return fn(SigmoidAct{});
+    case Activation::Relu:
+      return fn(ReluAct{});
+    case Activation::Tanh:
+      return fn(TanhAct{});
+    case Activation::Sin:
+      return fn(SinAct{});
+    case Activation::Identity:
+      return fn(IdentityAct{});
+    case Activation::Softmax:
+      return fn(SoftmaxAct{});
+  }
+  assert(false && "unreachable");
+  return fn(SigmoidAct{});
+}
+
+// X = Act(X) for a rows x cols block
+template <typename Act>
+void activate(float* x, size_t rows, size_t cols) {
+  size_t n = rows * cols;
+  if constexpr (requires { Act::f_rows(x, rows, cols); }) {
+    Act::f_rows(x, rows, cols);
+  } else if constexpr (requires { Act::f_n(x, n); }) {
+    Act::f_n(x, n);
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      x[i] = Act::f(x[i]);
+    }
+  }
+}
+
+// dz[i] = s * da[i] * Act'(y[i], z[i]), the per-layer backprop step, for
+// a rows x cols block
+template <typename Act>
+void activation_grad(float* dz, const float* da, const float* y,
+                     const float* z, float s, size_t rows, size_t cols) {
+  size_t n = rows * cols;
+  if constexpr (requires { Act::df_rows(dz, da, y, z, s, rows, cols); }) {
+    Act::df_rows(dz, da, y, z, s, rows, cols);
+  } else if constexpr (requires { Act::df_n(dz, da, y, z, s, n); }) {
+    Act::df_n(dz, da, y, z, s, n);
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      dz[i] = s * da[i] * Act::df(y[i], z[i]);
+    }
+  }
+}
+
+// Activation Function
+inline float Actf(float x, Activation act = NN_ACT) {
+  return with_activation(act, [x](auto a) { return decltype(a)::f(x); });
+}
+
+// Derivative of the Activation Function
+// y = activated output, z = pre-activation input
+inline float Dactf(float y, float z, Activation dact = NN_ACT) {
+  return with_activation(dact,
+                         [y, z](auto a) { return decltype(a)::df(y, z); });
+}
+
+inline float rand_float(float low, float high) {
+  static std::mt19937 gen(std::random_device{}());
+  std::uniform_real_distribution<float> dist(low, high);
+  return dist(gen);
+}
+
+// Persistent worker pool
+//
+// Workers are started once and sleep on a condition variable between jobs,
+// so a parallel_for costs a wake-up rather than a thread spawn. The calling
+// thread takes tasks too. Calls made from inside a task (or while another
+// thread owns the pool) run serially instead of deadlocking.
+class ThreadPool {
+ public:
+  explicit ThreadPool(size_t threads = 0) { resize(threads); }
+  ~ThreadPool() { stop_workers(); }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // number of threads that run tasks, including the caller
+  size_t size() const { return workers.size() + 1; }
+
+  void resize(size_t threads) {
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::lock_guard<std::mutex> job(job_mutex);
+    stop_workers();
+    size_t current;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = false;
+      current = generation;
+    }
+    // new workers must not mistake the last job for a fresh one
+    for (size_t i = 1; i < threads; ++i) {
+      workers.emplace_back([this, current] { worker_loop(current); });
+    }
+  }
+
+  // calls f(i) for every i in [0, n), in no particular order
+  template <typename F>
+  void parallel_for(size_t n, F&& f) {
+    if (n == 0) {
+      return;
+    }
+    std::unique_lock<std::mutex> job(job_mutex, std::defer_lock);
+    // workers is only read under job_mutex: resize() rewrites it
+    if (n == 1 || in_task() || !job.try_lock() || workers.empty()) {
+      if (job.owns_lock()) {
+        job.unlock();
+      }
+      for (size_t i = 0; i < n; ++i) {
+        f(i);
+      }
+      return;
+    }
+    using Fn = std::remove_reference_t<F>;
+    run([](void* ctx, size_t i) { (*static_cast<Fn*>(ctx))(i); },
+        const_cast<void*>(static_cast<const void*>(&f)), n);
+  }
+
+ private:
+  using TaskFn = void (*)(void*, size_t);
+
+  std::vector<std::thread> workers;
+  std::mutex job_mutex;  // one job in flight at a time
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  bool stop = false;
+  size_t generation = 0;
+  size_t pending = 0;
+
+  TaskFn task = nullptr;
+  void* ctx = nullptr;
+  size_t count = 0;
+  std::atomic<size_t> next{0};
+
+  static bool& in_task() {
+    thread_local bool flag = false;
+    return flag;
+  }
+
+  void run(TaskFn fn, void* c, size_t n) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = fn;
+      ctx = c;
+      count = n;
+      next.store(0, std::memory_order_relaxed);
+      pending = workers.size();
+      ++generation;
+    }
+    wake.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+  }
+
+  void work() {
+    bool& flag = in_task();
+    bool prev = flag;
+    flag = true;
+    for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+      task(ctx, i);
+    }
+    flag = prev;
+  }
+
+  void worker_loop(size_t seen) {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stop || generation != seen; });
+        if (stop) {
+          return;
+        }
+        seen = generation;
+      }
+      work();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+  void stop_workers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) {
+      w.join();
+    }
+    workers.clear();
+  }
+};
+
+// the pool shared by everything in nn::
+inline ThreadPool& thread_pool() {
+  static ThreadPool pool(NN_NUM_THREADS);
+  return pool;
+}
+
+// 0 = one thread per hardware thread
+inline void set_num_threads(size_t n) { thread_pool().resize(n); }
+inline size_t get_num_threads() { return thread_pool().size(); }
+
+// Hot-path profiler
+//
+// Built with -DNN_PROFILE, the forward pass, backprop and the weight
+// updates open a scope per layer and step that records its wall time, the
+// FLOPs and bytes it is counted as, and the heap allocations made inside
+// it. FLOPs are the arithmetic of the step and bytes each operand read or
+// written once (packing, cache misses and the like are not counted), so
+// GFLOP/s and GB/s say how close a step runs to the machine, not what it
+// did. Allocations are only counted when one translation unit defines
+// NN_PROFILE_ALLOCS before including nn.h, which replaces the global
+// operator new there. Without NN_PROFILE every NN_PROFILE_SCOPE compiles
+// to nothing and there is nothing to report.
+//   nn::prof::reset();
+//   ... train ...
+//   nn::prof::print_summary();                   // per phase / layer / step
+//   nn::prof::write_chrome_trace("trace.json");  // chrome://tracing, Perfetto
+// Events are kept per thread without locking; reset(), summary() and the
+// reports must not run while profiled code does.
+namespace prof {
+
+// Data is gathering a shuffled minibatch (Scheduler::next); Other is free
+// for scopes in user code
+enum class Phase { Forward, Backward, Update, Data, Other };
+
+inline const char* phase_name(Phase p) {
+  switch (p) {
+    case Phase::Forward:
+      return "forward";
+    case Phase::Backward:
+      return "backward";
+    case Phase::Update:
+      return "update";
+    case Phase::Data:
+      return "data";
+    case Phase::Other:
+      return "other";
+  }
+  return "?";
+}
+
+struct Event {
+  const char* name;  // a string literal
+  int layer;         // weight layer, -1 for the whole network
+  Phase phase;
+  int64_t start_ns;  // since the last reset()
+  int64_t ns;
+  double flops;
+  double bytes;
+  uint64_t allocs;
+};
+
+struct ThreadLog {
+  uint32_t id;  // registration order; the trace's tid
+  std::vector<Event> events;
+};
+
+struct State {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadLog>> logs;  // kept after threads exit
+  std::chrono::steady_clock::time_point epoch =
+      std::chrono::steady_clock::now();
+};
+
+inline State& state() {
+  static State s;
+  return s;
+}
+
+// allocations made by this thread, bumped by the NN_PROFILE_ALLOCS
+// operator new unless paused (the profiler's own bookkeeping)
+inline uint64_t& alloc_count() {
+  thread_local uint64_t n = 0;
+  return n;
+}
+
+inline bool& paused() {
+  thread_local bool p = false;
+  return p;
+}
+
+inline ThreadLog& thread_log() {
+  thread_local ThreadLog* log = [] {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.logs.push_back(std::make_unique<ThreadLog>());
+    s.logs.back()->id = uint32_t(s.logs.size() - 1);
+    return s.logs.back().get();
+  }();
+  return *log;
+}
+
+// times the enclosing block; use through NN_PROFILE_SCOPE
+class Scope {
+ public:
+  Scope(const char* name, int layer, Phase phase, double flops = 0.0,
+        double bytes = 0.0)
+      : name(name),
+        layer(layer),
+        phase(phase),
+        flops(flops),
+        bytes(bytes),
+        allocs(alloc_count()),
+        start(std::chrono::steady_clock::now()) {}
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+  ~Scope() {
+    auto end = std::chrono::steady_clock::now();
+    uint64_t made = alloc_count() - allocs;
+    paused() = true;
+    auto ns = [](auto d) {
+      return int64_t(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    };
+    thread_log().events.push_back({name, layer, phase,
+                                   ns(start - state().epoch),
+                                   ns(end - start), flops, bytes, made});
+    paused() = false;
+  }
+
+ private:
+  const char* name;
+  int layer;
+  Phase phase;
+  double flops, bytes;
+  uint64_t allocs;
+  std::chrono::steady_clock::time_point start;
+};
+
+// drops every recorded event (the buffers keep their capacity) and
+// restarts the trace clock
+inline void reset() {
+  State& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  for (auto& log : s.logs) {
+    log->events.clear();
+  }
+  s.epoch = std::chrono::steady_clock::now();
+}
+
+// events of one (phase, layer, step) summed over calls and threads
+struct Row {
+  Phase phase;
+  int layer;
+  const char* name;
+  size_t calls = 0;
+  double seconds = 0.0;
+  double flops = 0.0;
+  double bytes = 0.0;
+  uint64_t allocs = 0;
+};
+
+// ordered by phase, then layer, then first appearance
+inline std::vector<Row> summary() {
+  State& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  std::vector<Row> rows;
+  for (const auto& log : s.logs) {
+    for (const Event& e : log->events) {
+      auto it = std::find_if(rows.begin(), rows.end(), [&](const Row& r) {
+        return r.phase == e.phase && r.layer == e.layer &&
+               std::strcmp(r.name, e.name) == 0;
+      });
+      if (it == rows.end()) {
+        rows.push_back({e.phase, e.layer, e.name});
+        it = rows.end() - 1;
+      }
+      ++it->calls;
+      it->seconds += e.ns * 1e-9;
+      it->flops += e.flops;
+      it->bytes += e.bytes;
+      it->allocs += e.allocs;
+    }
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    return std::pair(a.phase, a.layer) < std::pair(b.phase, b.layer);
+  });
+  return rows;
+}
+
+// summary() as a table, with each row's share of the profiled time and
+// the totals per phase
+inline void print_summary(std::ostream& out = std::cout) {
+  std::vector<Row> rows = summary();
+  if (rows.empty()) {
+    out << "no profile events (build with -DNN_PROFILE)\n";
+    return;
+  }
+  double total = 0.0;
+  for (const Row& r : rows) {
+    total += r.seconds;
+  }
+  char line[160];
+  std::snprintf(line, sizeof(line),
+                "%-8s %5s  %-16s %8s %10s %6s %10s %8s %8s %7s\n", "phase",
+                "layer", "step", "calls", "total ms", "share", "mean us",
+                "GFLOP/s", "GB/s", "allocs");
+  out << line;
+  for (const Row& r : rows) {
+    char layer[16] = "-";
+    if (r.layer >= 0) {
+      std::snprintf(layer, sizeof(layer), "%d", r.layer);
+    }
+    std::snprintf(line, sizeof(line),
+                  "%-8s %5s  %-16s %8zu %10.3f %5.1f%% %10.2f %8.2f %8.2f "
+                  "%7llu\n",
+                  phase_name(r.phase), layer, r.name, r.calls,
+                  r.seconds * 1e3, 100.0 * r.seconds / total,
+                  r.seconds * 1e6 / r.calls, r.flops / r.seconds * 1e-9,
+                  r.bytes / r.seconds * 1e-9, (unsigned long long)r.allocs);
+    out << line;
+  }
+  out << "total:";
+  for (Phase p : {Phase::Forward, Phase::Backward, Phase::Update,
+                  Phase::Data, Phase::Other}) {
+    double t = 0.0;
+    for (const Row& r : rows) {
+      t += r.phase == p ? r.seconds : 0.0;
+    }
+    if (t > 0.0) {
+      std::snprintf(line, sizeof(line), " %s %.3f ms", phase_name(p),
+                    t * 1e3);
+      out << line;
+    }
+  }
+  out << '\n';
+}
+
+// every event as a Chrome trace-event "complete" event (ph X, times in
+// microseconds), one track per thread; open it in chrome://tracing or
+// ui.perfetto.dev
+inline bool write_chrome_trace(const std::filesystem::path& path) {
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+  State& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  char buf[384];
+  const char* sep = "\n";
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  for (const auto& log : s.logs) {
+    std::snprintf(buf, sizeof(buf),
+                  "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+                  "\"tid\": %u, \"args\": {\"name\": \"nn thread %u\"}}",
+                  sep, log->id, log->id);
+    out << buf;
+    sep = ",\n";
+    for (const Event& e : log->events) {
+      std::snprintf(buf, sizeof(buf),
+                    "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                    "\"pid\": 0, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                    "\"args\": {\"layer\": %d, \"flops\": %.0f, "
+                    "\"bytes\": %.0f, \"allocs\": %llu}}",
+                    sep, e.name, phase_name(e.phase), log->id,
+                    e.start_ns * 1e-3, e.ns * 1e-3, e.layer, e.flops,
+                    e.bytes, (unsigned long long)e.allocs);
+      out << buf;
+    }
+  }
+  out << "\n]}\n";
+  return bool(out);
+}
+
+}  // namespace prof
+
+// NN_PROFILE_SCOPE(name, layer, phase[, flops, bytes]) times the rest of
+// the enclosing block; name must outlive the profile (a string literal)
+#ifdef NN_PROFILE
+#define NN_PROFILE_CONCAT_(a, b) a##b
+#define NN_PROFILE_CONCAT(a, b) NN_PROFILE_CONCAT_(a, b)
+#define NN_PROFILE_SCOPE(...)                                       \
+  ::nn::prof::Scope NN_PROFILE_CONCAT(nn_profile_scope_, __LINE__)( \
+      __VA_ARGS__)
+#else
+#define NN_PROFILE_SCOPE(...) static_cast<void>(0)
+#endif
+
+// how sgemm reads an operand: as stored (N) or as its transpose (T)
+enum class Trans { N, T };
+
+// GEMM engine used by Matrix::dot
+//
+// C = alpha * A.B + beta * C for row-major A (m x k), B (k x n), C (m x n)
+// with leading dimensions lda/ldb/ldc. Either of A and B may instead be
+// stored transposed; only the packing routines and the few-row path care.
+// The loop nest follows the usual Goto/BLIS layout: B is packed into
+// KC x NC panels that stay in L2, A into MC x KC panels that stay in
+// L1/L2, and a MR x NR micro-kernel keeps its tile of C in vector
+// registers for the whole KC loop.
+namespace gemm {
+
+#if defined(__AVX512F__)
+constexpr size_t kVecWidth = 16;
+#elif defined(__AVX__)
+constexpr size_t kVecWidth = 8;
+#else
+constexpr size_t kVecWidth = 4;
+#endif
+
+// micro tile: MR rows of A times NR columns of B held in registers
+constexpr size_t MR = kVecWidth == 4 ? 4 : 6;
+constexpr size_t NR = 2 * kVecWidth;
+// cache blocks
+constexpr size_t KC = 256;
+constexpr size_t MC = 96;
+constexpr size_t NC = 2048;
+// below this many rows of A packing does not pay off and we stream B
+// row by row instead (this is the 1 x N . N x M case forward() hits)
+constexpr size_t kSkinnyRows = MR;
+// multiply-adds below which waking the pool costs more than it saves
+constexpr size_t kParallelMinWork = size_t(1) << 18;
+
+typedef float vfloat __attribute__((vector_size(kVecWidth * sizeof(float))));
+constexpr size_t kVecPerTile = NR / kVecWidth;
+
+inline vfloat load(const float* p) {
+  vfloat v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline void store(float* p, vfloat v) { std::memcpy(p, &v, sizeof(v)); }
+
+// address of element (i, j) of an operand with leading dimension ld,
+// stored transposed when t is set
+template <typename T>
+inline const T* offset(const T* p, size_t ld, bool t, size_t i, size_t j) {
+  return t ? p + j * ld + i : p + i * ld + j;
+}
+
+// sum of x[i] * y[i], kVecWidth partial sums at a time
+inline float dot(size_t n, const float* x, const float* y) {
+  vfloat acc = {};
+  size_t i = 0;
+  for (; i + kVecWidth <= n; i += kVecWidth) {
+    acc += load(x + i) * load(y + i);
+  }
+  float sum = 0.0f;
+  for (size_t v = 0; v < kVecWidth; ++v) {
+    sum += acc[v];
+  }
+  for (; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+// scratch for packed panels, one set per thread so the hot path never
+// touches the allocator once the buffers have grown to size
+inline float* pack_buffer_a() {
+  thread_local std::vector<float> buf(MC * KC);
+  return buf.data();
+}
+
+inline float* pack_buffer_b() {
+  thread_local std::vector<float> buf(KC * NC);
+  return buf.data();
+}
+
+// copies an mc x kc block of A into MR-row panels, column by column,
+// zero padding the last panel. A stored transposed (ta) has each panel
+// column contiguous, so that case is the cheaper one.
+inline void pack_a(size_t mc, size_t kc, const float* a, size_t lda, bool ta,
+                   float* dst) {
+  for (size_t i = 0; i < mc; i += MR) {
+    size_t mr = std::min(MR, mc - i);
+    for (size_t p = 0; p < kc; ++p) {
+      const float* src = ta ? a + p * lda + i : a + i * lda + p;
+      size_t step = ta ? 1 : lda;
+      for (size_t ii = 0; ii < mr; ++ii) {
+        dst[ii] = src[ii * step];
+      }
+      for (size_t ii = mr; ii < MR; ++ii) {
+        dst[ii] = 0.0f;
+      }
+      dst += MR;
+    }
+  }
+}
+
+// copies a kc x nc block of B into NR-column panels, row by row,
+// zero padding the last panel. A bf16 / fp16 B is widened to fp32 here,
+// one row at a time, so the kernel only ever sees fp32. A B stored
+// transposed (tb, fp32 only) is read along its stored rows, one panel
+// column at a time; the strided writes land in a panel that fits in L1.
+template <typename TB>
+void pack_b(size_t kc, size_t nc, const TB* b, size_t ldb, bool tb,
+            float* dst) {
+  if constexpr (std::is_same_v<TB, float>) {
+    if (tb) {
+      for (size_t j = 0; j < nc; j += NR) {
+        size_t nr = std::min(NR, nc - j);
+        for (size_t jj = 0; jj < NR; ++jj) {
+          const float* src = b + (j + jj) * ldb;
+          for (size_t p = 0; p < kc; ++p) {
+            dst[p * NR + jj] = jj < nr ? src[p] : 0.0f;
+          }
+        }
+        dst += kc * NR;
+      }
+      return;
+    }
+    for (size_t j = 0; j < nc; j += NR) {
+      size_t nr = std::min(NR, nc - j);
+      for (size_t p = 0; p < kc; ++p) {
+        const float* src = b + p * ldb + j;
+        for (size_t jj = 0; jj < nr; ++jj) {
+          dst[jj] = src[jj];
+        }
+        for (size_t jj = nr; jj < NR; ++jj) {
+          dst[jj] = 0.0f;
+        }
+        dst += NR;
+      }
+    }
+  } else {
+    assert(!tb);
+    thread_local std::vector<float> wide(NC);
+    for (size_t p = 0; p < kc; ++p) {
+      convert(b + p * ldb, wide.data(), nc);
+      for (size_t j = 0; j < nc; j += NR) {
+        size_t nr = std::min(NR, nc - j);
+        float* panel = dst + j * kc + p * NR;
+        std::copy(wide.data() + j, wide.data() + j + nr, panel);
+        std::fill(panel + nr, panel + NR, 0.0f);
+      }
+    }
+  }
+}
+
+// What to do with a finished block of C before it leaves the kernel:
+// add a bias row, keep a copy of the pre-activation values in z, then
+// apply the activation the kernel was instantiated with. Pointers are
+// rebased with at() so each tile sees its own corner.
+struct Epilogue {
+  const float* bias = nullptr;  // 1 x n
+  float* z = nullptr;           // m x n with leading dimension ldz
+  size_t ldz = 0;
+
+  Epilogue at(size_t i, size_t j) const {
+    return {bias ? bias + j : nullptr, z ? z + i * ldz + j : nullptr, ldz};
+  }
+};
+
+// applies an epilogue to m finished rows of C
+template <typename Act>
+void epilogue_rows(size_t m, size_t n, float* c, size_t ldc,
+                   const Epilogue& ep) {
+  for (size_t i = 0; i < m; ++i) {
+    float* row = c + i * ldc;
+    if (ep.bias) {
+      for (size_t j = 0; j < n; ++j) {
+        row[j] += ep.bias[j];
+      }
+    }
+    if (ep.z) {
+      std::copy(row, row + n, ep.z + i * ep.ldz);
+    }
+    activate<Act>(row, 1, n);
+  }
+}
+
+// MR x NR tile of C += packed A panel . packed B panel
+// only the top-left mr x nr corner is written back; with an epilogue
+// (last slice of K only) the tile is finished in a stack buffer while it
+// is still in L1 and written to C once
+template <typename Act>
+void micro_kernel(size_t kc, const float* ap, const float* bp, float* c,
+                  size_t ldc, size_t mr, size_t nr, float alpha, float beta,
+                  const Epilogue* ep) {
+  vfloat acc[MR][kVecPerTile] = {};
+  for (size_t p = 0; p < kc; ++p) {
+    vfloat bv[kVecPerTile];
+    for (size_t v = 0; v < kVecPerTile; ++v) {
+      bv[v] = load(bp + v * kVecWidth);
+    }
+    for (size_t i = 0; i < MR; ++i) {
+      float av = ap[i];
+      for (size_t v = 0; v < kVecPerTile; ++v) {
+        acc[i][v] += bv[v] * av;
+      }
+    }
+    ap += MR;
+    bp += NR;
+  }
+
+  if (!ep && mr == MR && nr == NR) {
+    for (size_t i = 0; i < MR; ++i) {
+      float* row = c + i * ldc;
+      for (size_t v = 0; v < kVecPerTile; ++v) {
+        vfloat r = acc[i][v] * alpha;
+        if (beta != 0.0f) {
+          r += load(row + v * kVecWidth) * beta;
+        }
+        store(row + v * kVecWidth, r);
+      }
+    }
+    return;
+  }
+
+  float tile[MR][NR];
+  for (size_t i = 0; i < MR; ++i) {
+    for (size_t v = 0; v < kVecPerTile; ++v) {
+      store(&tile[i][v * kVecWidth], acc[i][v] * alpha);
+    }
+  }
+  if (mr == MR && nr == NR) {
+    vfloat bias[kVecPerTile] = {};
+    if (ep->bias) {
+      for (size_t v = 0; v < kVecPerTile; ++v) {
+        bias[v] = load(ep->bias + v * kVecWidth);
+      }
+    }
+    for (size_t i = 0; i < MR; ++i) {
+      for (size_t v = 0; v < kVecPerTile; ++v) {
+        vfloat r = load(&tile[i][v * kVecWidth]) + bias[v];
+        if (beta != 0.0f) {
+          r += load(c + i * ldc + v * kVecWidth) * beta;
+        }
+        store(&tile[i][v * kVecWidth], r);
+        if (ep->z) {
+          store(ep->z + i * ep->ldz + v * kVecWidth, r);
+        }
+      }
+    }
+  } else {
+    for (size_t i = 0; i < mr; ++i) {
+      const float* row = c + i * ldc;
+      for (size_t j = 0; j < nr; ++j) {
+        if (beta != 0.0f) {
+          tile[i][j] += beta * row[j];
+        }
+        if (ep && ep->bias) {
+          tile[i][j] += ep->bias[j];
+        }
+      }
+      if (ep && ep->z) {
+        std::copy(tile[i], tile[i] + nr, ep->z + i * ep->ldz);
+      }
+    }
+  }
+  if (ep) {
+    activate<Act>(&tile[0][0], MR, NR);
+  }
+  for (size_t i = 0; i < mr; ++i) {
+    std::copy(tile[i], tile[i] + nr, c + i * ldc);
+  }
+}
+
+// C rows scaled by beta; beta == 0 overwrites so NaNs in C do not leak
+inline void scale_rows(size_t m, size_t n, float beta, float* c, size_t ldc) {
+  for (size_t i = 0; i < m; ++i) {
+    float* row = c + i * ldc;
+    if (beta == 0.0f) {
+      std::fill(row, row + n, 0.0f);
+    } else if (beta != 1.0f) {
+      for (size_t j = 0; j < n; ++j) {
+        row[j] *= beta;
+      }
+    }
+  }
+}
+
+// B values widened to fp32, one at a time or kVecWidth at a time in
+// registers. bf16 is a shift; fp16 needs F16C, so without -mf16c (or a
+// -march that has it) an fp16 B goes through the block-widening
+// gemm_skinny below instead.
+inline float widen(float x) { return x; }
+inline float widen(bf16 x) { return half::to_float(x); }
+inline float widen(fp16 x) { return half::to_float(x); }
+
+inline vfloat load_b(const float* p) { return load(p); }
+
+inline vfloat load_b(const bf16* p) {
+  typedef uint16_t h __attribute__((vector_size(kVecWidth * 2)));
+  typedef uint32_t u __attribute__((vector_size(kVecWidth * 4)));
+  h x;
+  std::memcpy(&x, p, sizeof(x));
+  u w = __builtin_convertvector(x, u) << 16;
+  vfloat v;
+  std::memcpy(&v, &w, sizeof(v));
+  return v;
+}
+
+#if defined(__F16C__)
+inline vfloat load_b(const fp16* p) {
+#if defined(__AVX512F__)
+  // the maskz form: GCC 12 warns about _mm512_cvtph_ps's undefined source
+  return (vfloat)_mm512_maskz_cvtph_ps(
+      0xffff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+#elif defined(__AVX__)
+  return (vfloat)_mm256_cvtph_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+#else
+  return (vfloat)_mm_cvtph_ps(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+#endif
+}
+#endif
+
+template <typename TB>
+concept WidensInRegister = requires(const TB* p) { load_b(p); };
+
+// few rows of A: every row of B is read once per row of A in order, which
+// is already unit stride, so skip packing entirely. A bf16 / fp16 B is
+// widened as it is loaded, so it streams half the bytes of an fp32 one.
+template <typename Act, WidensInRegister TB>
+void gemm_skinny(size_t m, size_t n, size_t k, float alpha, const float* a,
+                 size_t lda, const TB* b, size_t ldb, float beta, float* c,
+                 size_t ldc, const Epilogue* ep) {
+  scale_rows(m, n, beta, c, ldc);
+  for (size_t i = 0; i < m; ++i) {
+    float* crow = c + i * ldc;
+    const float* arow = a + i * lda;
+    size_t p = 0;
+    // four rows of B per sweep over C quarters the C load/store traffic
+    for (; p + 4 <= k; p += 4) {
+      float a0 = alpha * arow[p], a1 = alpha * arow[p + 1];
+      float a2 = alpha * arow[p + 2], a3 = alpha * arow[p + 3];
+      const TB* b0 = b + p * ldb;
+      const TB* b1 = b0 + ldb;
+      const TB* b2 = b1 + ldb;
+      const TB* b3 = b2 + ldb;
+      size_t j = 0;
+      for (; j + kVecWidth <= n; j += kVecWidth) {
+        vfloat r = load_b(b0 + j) * a0 + load_b(b1 + j) * a1 +
+                   load_b(b2 + j) * a2 + load_b(b3 + j) * a3;
+        store(crow + j, load(crow + j) + r);
+      }
+      for (; j < n; ++j) {
+        crow[j] += a0 * widen(b0[j]) + a1 * widen(b1[j]) + a2 * widen(b2[j]) +
+                   a3 * widen(b3[j]);
+      }
+    }
+    for (; p < k; ++p) {
+      float av = alpha * arow[p];
+      const TB* brow = b + p * ldb;
+      for (size_t j = 0; j < n; ++j) {
+        crow[j] += av * widen(brow[j]);
+      }
+    }
+    // the row is still in L1
+    if (ep) {
+      epilogue_rows<Act>(1, n, crow, ldc, ep->at(i, 0));
+    }
+  }
+}
+
+// block of B widened at a time by the fallback below; 32 KB, so it is
+// still in L1 when the fp32 loop reads it back
+constexpr size_t kWidenRows = 16;
+constexpr size_t kWidenCols = 512;
+
+// the same for a B the kernel cannot widen in registers: blocks of it are
+// widened into the B pack buffer (by convert(), which still picks F16C at
+// runtime), once for all the rows of A, and run through the fp32 loop
+template <typename Act, typename TB>
+  requires(!WidensInRegister<TB>)
+void gemm_skinny(size_t m, size_t n, size_t k, float alpha, const float* a,
+                 size_t lda, const TB* b, size_t ldb, float beta, float* c,
+                 size_t ldc, const Epilogue* ep) {
+  scale_rows(m, n, beta, c, ldc);
+  float* wide = pack_buffer_b();
+  for (size_t jc = 0; jc < n; jc += kWidenCols) {
+    size_t nc = std::min(kWidenCols, n - jc);
+    for (size_t pc = 0; pc < k; pc += kWidenRows) {
+      size_t kc = std::min(kWidenRows, k - pc);
+      for (size_t p = 0; p < kc; ++p) {
+        convert(b + (pc + p) * ldb + jc, wide + p * nc, nc);
+      }
+      gemm_skinny<IdentityAct>(m, nc, kc, alpha, a + pc, lda, wide, nc, 1.0f,
+                               c + jc, ldc, nullptr);
+    }
+  }
+  if (ep) {
+    epilogue_rows<Act>(m, n, c, ldc, *ep);
+  }
+}
+
+// the few-rows case with either operand stored transposed (fp32 only).
+// A^T is gathered into m short rows first; with B^T every element of C is
+// the dot product of two unit-stride rows.
+template <typename Act, typename TB>
+void gemm_few_rows(size_t m, size_t n, size_t k, float alpha, const float* a,
+                   size_t lda, const TB* b, size_t ldb, float beta, float* c,
+                   size_t ldc, const Epilogue* ep, bool ta, bool tb) {
+  if constexpr (std::is_same_v<TB, float>) {
+    if (ta) {
+      thread_local std::vector<float> rows;
+      rows.resize(m * k);
+      for (size_t p = 0; p < k; ++p) {
+        for (size_t i = 0; i < m; ++i) {
+          rows[i * k + p] = a[p * lda + i];
+        }
+      }
+      a = rows.data();
+      lda = k;
+    }
+    if (tb) {
+      for (size_t i = 0; i < m; ++i) {
+        float* crow = c + i * ldc;
+        for (size_t j = 0; j < n; ++j) {
+          float s = alpha * dot(k, a + i * lda, b + j * ldb);
+          crow[j] = beta == 0.0f ? s : beta * crow[j] + s;
+        }
+        if (ep) {
+          epilogue_rows<Act>(1, n, crow, ldc, ep->at(i, 0));
+        }
+      }
+      return;
+    }
+  } else {
+    assert(!ta && !tb);
+  }
+  gemm_skinny<Act>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, ep);
+}
+
+template <typename Act, typename TB>
+void gemm_blocked(size_t m, size_t n, size_t k, float alpha, const float* a,
+                  size_t lda, const TB* b, size_t ldb, float beta,
+                  float* c, size_t ldc, const Epilogue* ep, bool ta = false,
+                  bool tb = false) {
+  float* bp = pack_buffer_b();
+  float* ap = pack_buffer_a();
+  for (size_t jc = 0; jc < n; jc += NC) {
+    size_t nc = std::min(NC, n - jc);
+    for (size_t pc = 0; pc < k; pc += KC) {
+      size_t kc = std::min(KC, k - pc);
+      // only the first slice of K applies the caller's beta, only the last
+      // one runs the epilogue
+      float bk = pc == 0 ? beta : 1.0f;
+      bool last = pc + kc == k;
+      pack_b(kc, nc, offset(b, ldb, tb, pc, jc), ldb, tb, bp);
+      for (size_t ic = 0; ic < m; ic += MC) {
+        size_t mc = std::min(MC, m - ic);
+        pack_a(mc, kc, offset(a, lda, ta, ic, pc), lda, ta, ap);
+        for (size_t jr = 0; jr < nc; jr += NR) {
+          size_t nr = std::min(NR, nc - jr);
+          for (size_t ir = 0; ir < mc; ir += MR) {
+            size_t mr = std::min(MR, mc - ir);
+            Epilogue tile_ep;
+            if (ep && last) {
+              tile_ep = ep->at(ic + ir, jc + jr);
+            }
+            micro_kernel<Act>(kc, ap + ir * kc, bp + jr * kc,
+                              c + (ic + ir) * ldc + jc + jr, ldc, mr, nr,
+                              alpha, bk, ep && last ? &tile_ep : nullptr);
+          }
+        }
+      }
+    }
+  }
+}
+
+inline size_t round_up(size_t x, size_t to) { return (x + to - 1) / to * to; }
+
+// splits C into a grid of output tiles and runs the serial kernels on each
+// tile in the pool; tiles never share an element of C, so no reduction is
+// needed and the result does not depend on the thread count
+template <typename Act, typename TB>
+void gemm_parallel(size_t m, size_t n, size_t k, float alpha, const float* a,
+                   size_t lda, const TB* b, size_t ldb, float beta,
+                   float* c, size_t ldc, const Epilogue* ep, bool ta = false,
+                   bool tb = false) {
+  ThreadPool& pool = thread_pool();
+  size_t want = 2 * pool.size();
+
+  if (m < kSkinnyRows) {
+    size_t tile_n = std::max<size_t>(256, round_up((n + want - 1) / want, NR));
+    size_t tiles = (n + tile_n - 1) / tile_n;
+    pool.parallel_for(tiles, [&](size_t t) {
+      size_t j = t * tile_n;
+      Epilogue tile_ep = ep ? ep->at(0, j) : Epilogue{};
+      gemm_few_rows<Act>(m, std::min(tile_n, n - j), k, alpha, a, lda,
+                         offset(b, ldb, tb, 0, j), ldb, beta, c + j, ldc,
+                         ep ? &tile_ep : nullptr, ta, tb);
+    });
+    return;
+  }
+
+  size_t tile_m = MC;
+  size_t tile_n = 256;
+  auto tiles = [&] {
+    return ((m + tile_m - 1) / tile_m) * ((n + tile_n - 1) / tile_n);
+  };
+  while (tiles() < want && tile_n > 2 * NR) {
+    tile_n = round_up(tile_n / 2, NR);
+  }
+  while (tiles() < want && tile_m > 2 * MR) {
+    tile_m = round_up(tile_m / 2, MR);
+  }
+  size_t col_tiles = (n + tile_n - 1) / tile_n;
+  pool.parallel_for(tiles(), [&](size_t t) {
+    size_t i = (t / col_tiles) * tile_m;
+    size_t j = (t % col_tiles) * tile_n;
+    Epilogue tile_ep = ep ? ep->at(i, j) : Epilogue{};
+    gemm_blocked<Act>(std::min(tile_m, m - i), std::min(tile_n, n - j), k,
+                      alpha, offset(a, lda, ta, i, 0), lda,
+                      offset(b, ldb, tb, 0, j), ldb, beta, c + i * ldc + j,
+                      ldc, ep ? &tile_ep : nullptr, ta, tb);
+  });
+}
+
+template <typename Act, typename TB>
+void run(size_t m, size_t n, size_t k, float alpha, const float* a,
+         size_t lda, const TB* b, size_t ldb, float beta, float* c,
+         size_t ldc, const Epilogue* ep, bool ta = false, bool tb = false) {
+  if (m == 0 || n == 0) {
+    return;
+  }
+  if (k == 0) {
+    scale_rows(m, n, beta, c, ldc);
+    if (ep) {
+      epilogue_rows<Act>(m, n, c, ldc, *ep);
+    }
+    return;
+  }
+  if (m * n * k >= kParallelMinWork && thread_pool().size() > 1) {
+    gemm_parallel<Act>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, ep, ta,
+                       tb);
+  } else if (m < kSkinnyRows) {
+    gemm_few_rows<Act>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, ep, ta,
+                       tb);
+  } else {
+    gemm_blocked<Act>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, ep, ta,
+                      tb);
+  }
+}
+
+}  // namespace gemm
+
+// B may be float, bf16 or fp16; a reduced-precision B is widened as it is
+// packed, so products and sums are always fp32
+template <typename TB>
+void sgemm(size_t m, size_t n, size_t k, float alpha, const float* a,
+           size_t lda, const TB* b, size_t ldb, float beta, float* c,
+           size_t ldc) {
+  gemm::run<IdentityAct>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc,
+                         nullptr);
+}
+
+// C = alpha * op(A).op(B) + beta * C, op(X) being X or, with Trans::T, X
+// transposed: A is then stored k x m and / or B n x k. The transposed
+// operand is read in place while packing, never copied out first.
+inline void sgemm(Trans ta, Trans tb, size_t m, size_t n, size_t k,
+                  float alpha, const float* a, size_t lda, const float* b,
+                  size_t ldb, float beta, float* c, size_t ldc) {
+  gemm::run<IdentityAct>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc,
+                         nullptr, ta == Trans::T, tb == Trans::T);
+}
+
+// C = act(alpha * A.B + beta * C + bias), with the pre-activation values
+// also written to z when it is set, all in the GEMM's store step so each
+// output element goes to memory once (twice with z) instead of once per
+// pass. bias and z may be null.
+template <typename TB>
+void sgemm_fused(size_t m, size_t n, size_t k, float alpha, const float* a,
+                 size_t lda, const TB* b, size_t ldb, float beta, float* c,
+                 size_t ldc, const float* bias, float* z, size_t ldz,
+                 Activation act) {
+  gemm::Epilogue ep{bias, z, ldz};
+  // softmax needs whole rows, which a tile does not have: fuse the rest
+  // and normalize the finished rows afterwards
+  if (act == Activation::Softmax) {
+    gemm::run<IdentityAct>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, &ep);
+    for (size_t i = 0; i < m; ++i) {
+      SoftmaxAct::f_rows(c + i * ldc, 1, n);
+    }
+    return;
+  }
+  with_activation(act, [&](auto policy) {
+    gemm::run<decltype(policy)>(m, n, k, alpha, a, lda, b, ldb, beta, c, ldc,
+                                &ep);
+  });
+}
+
+// Read-only, non-owning window onto row-major floats; row i starts at
+// data + i * stride. Taking a block of rows and/or columns is O(1), so a
+// minibatch or the input/target columns of a training matrix never need
+// to be copied out. A Matrix converts to a view of itself implicitly.
+struct MatrixView {
+  const float* data = nullptr;
+  size_t rows = 0;
+  size_t cols = 0;
+  size_t stride = 0;
+
+  const float& operator()(size_t i, size_t j) const {
+    assert(i < rows && j < cols);
+    return data[i * stride + j];
+  }
+
+  const float* row(size_t i) const {
+    assert(i < rows);
+    return data + i * stride;
+  }
+
+  // rows [r, r + nr) x cols [c, c + nc)
+  MatrixView block(size_t r, size_t c, size_t nr, size_t nc) const {
+    assert(r + nr <= rows && c + nc <= cols);
+    return {data + r * stride + c, nr, nc, stride};
+  }
+
+  MatrixView row_range(size_t r, size_t nr) const {
+    return block(r, 0, nr, cols);
+  }
+
+  MatrixView col_range(size_t c, size_t nc) const {
+    return block(0, c, rows, nc);
+  }
+};
+
+template <typename T>
+struct TypedMatrix;
+
+class Matrix {
+ public:
+  size_t rows;
+  size_t cols;
+  std::vector<float> data;
+
+  Matrix(size_t r = 0, size_t c = 0, float d = 0.0f)
+      : rows(r), cols(c), data(r * c, d) {}
+
+  float& operator()(size_t i, size_t j) {
+    assert(i < this->rows && j < this->cols);
+    return this->data[i * cols + j];
+  }
+
+  // const one for reading only;
+  const float& operator()(size_t i, size_t j) const {
+    assert(i < rows && j < cols);
+    return data[i * cols + j];
+  }
+
+  void fill(float x) { std::fill(data.begin(), data.end(), x); }
+
+  MatrixView view() const { return {data.data(), rows, cols, cols}; }
+  operator MatrixView() const { return view(); }
+
+  MatrixView block(size_t r, size_t c, size_t nr, size_t nc) const {
+    return view().block(r, c, nr, nc);
+  }
+
+  // reshape keeping the buffer, so going back to a size that was used
+  // before does not allocate; contents are unspecified afterwards
+  void resize(size_t r, size_t c) {
+    rows = r;
+    cols = c;
+    data.resize(r * c);
+  }
+
+  void randomize(float low, float high) {
+    for (auto& d : data) {
+      d = rand_float(low, high);
+    }
+  }
+
+  void apply_activation(Activation act) {
+    with_activation(act, [this](auto a) { apply_activation<decltype(a)>(); });
+  }
+
+  template <typename Act>
+  void apply_activation() {
+    activate<Act>(data.data(), rows, cols);
+  }
+
+  Matrix& operator+=(const Matrix& other) {
+    assert(other.cols == cols && rows == other.rows);
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = data[i] + other.data[i];
+    }
+
+    return *this;
+  }
+
+  // adds a 1 x cols row to every row (bias broadcast over a batch)
+  Matrix& add_row(const Matrix& row) {
+    assert(row.rows == 1 && row.cols == cols);
+    for (size_t i = 0; i < rows; ++i) {
+      float* dst = &data[i * cols];
+      for (size_t j = 0; j < cols; ++j) {
+        dst[j] += row.data[j];
+      }
+    }
+    return *this;
+  }
+
+  Matrix& operator*=(float scale) {
+    assert(cols * rows == data.size());
+    for (auto& d : data) {
+      d *= scale;
+    }
+    return *this;
+  }
+
+  static Matrix dot(MatrixView a, MatrixView b) {
+    Matrix dst;
+    dot_into(dst, a, b);
+    return dst;
+  }
+
+  // dst = a . b, reusing dst's buffer (dst must not alias a or b)
+  static void dot_into(Matrix& dst, MatrixView a, MatrixView b) {
+    assert(a.cols == b.rows);
+    assert(dst.data.data() != a.data && dst.data.data() != b.data);
+    dst.resize(a.rows, b.cols);
+    sgemm(a.rows, b.cols, a.cols, 1.0f, a.data, a.stride, b.data, b.stride,
+          0.0f, dst.data.data(), dst.cols);
+  }
+
+  // dst = act(a . w + bias) in one pass over dst; z, when given, receives
+  // a . w + bias as well. bias is a 1 x w.cols row.
+  static void layer_into(Matrix& dst, MatrixView a, MatrixView w,
+                         MatrixView bias, Activation act, Matrix* z = nullptr) {
+    assert(a.cols == w.rows && bias.cols == w.cols);
+    assert(dst.data.data() != a.data && dst.data.data() != w.data);
+    dst.resize(a.rows, w.cols);
+    if (z) {
+      z->resize(a.rows, w.cols);
+    }
+    sgemm_fused(a.rows, w.cols, a.cols, 1.0f, a.data, a.stride, w.data,
+                w.stride, 0.0f, dst.data.data(), dst.cols, bias.data,
+                z ? z->data.data() : nullptr, w.cols, act);
+  }
+
+  // the same for weights stored as bf16 / fp16 (see TypedMatrix)
+  template <typename T>
+  static void dot_into(Matrix& dst, MatrixView a, const TypedMatrix<T>& b) {
+    assert(a.cols == b.rows);
+    dst.resize(a.rows, b.cols);
+    sgemm(a.rows, b.cols, a.cols, 1.0f, a.data, a.stride, b.data.data(),
+          b.cols, 0.0f, dst.data.data(), dst.cols);
+  }
+
+  template <typename T>
+  static void layer_into(Matrix& dst, MatrixView a, const TypedMatrix<T>& w,
+                         MatrixView bias, Activation act, Matrix* z = nullptr) {
+    assert(a.cols == w.rows && bias.cols == w.cols);
+    assert(dst.data.data() != a.data);
+    dst.resize(a.rows, w.cols);
+    if (z) {
+      z->resize(a.rows, w.cols);
+    }
+    sgemm_fused(a.rows, w.cols, a.cols, 1.0f, a.data, a.stride, w.data.data(),
+                w.cols, 0.0f, dst.data.data(), dst.cols, bias.data,
+                z ? z->data.data() : nullptr, w.cols, act);
+  }
+
+  // reference i-j-k loop, kept to check the blocked kernel against
+  static Matrix dot_naive(const Matrix& a, const Matrix& b) {
+    assert(a.cols == b.rows);
+    Matrix dst(a.rows, b.cols, 0.0f);
+    for (size_t i = 0; i < dst.rows; ++i) {
+      for (size_t j = 0; j < dst.cols; ++j) {
+        for (size_t k = 0; k < a.cols; ++k) {
+          dst(i, j) += a(i, k) * b(k, j);
+        }
+      }
+    }
+    return dst;
+  }
+  // row index , start col idx and how many next cols u want is that nums_cols
+  Matrix slice_row(size_t row_idx, size_t start_col, size_t num_cols) const {
+    assert(row_idx < rows);
+    assert(start_col + num_cols <= cols);
+    Matrix m(1, num_cols);
+    for (size_t k = 0; k < num_cols; k++) {
+      m(0, k) = (*this)(row_idx, start_col + k);
+    }
+    return m;
+  }
+
+  // in place when square; otherwise through one temporary buffer. To
+  // multiply by a transpose, pass Trans::T to sgemm instead.
+  Matrix& transpose() {
+    assert(rows * cols == data.size());
+    if (rows == cols) {
+      xpose::square(rows, data.data(), cols);
+      return *this;
+    }
+    std::vector<float> temp(data.size());
+    xpose::copy(rows, cols, data.data(), cols, temp.data(), rows);
+    data = std::move(temp);
+    std::swap(rows, cols);
+
+    return *this;
+  }
+
+  // dst = transpose of this, reusing dst's buffer
+  void transpose_into(Matrix& dst) const { transpose_into(dst, view()); }
+
+  static void transpose_into(Matrix& dst, MatrixView src) {
+    assert(dst.data.data() != src.data);
+    dst.resize(src.cols, src.rows);
+    xpose::copy(src.rows, src.cols, src.data, src.stride, dst.data.data(),
+                dst.cols);
+  }
+
+  // through an LU factorization (see LU below for factoring once and
+  // solving many times); an empty Matrix if not square or singular
+  Matrix inverse() const;
+  // 0 if singular
+  float determinant() const;
+  // X with (*this) X = b; nullopt if singular
+  std::optional<Matrix> solve(MatrixView b) const;
+
+  void print(const std::string& name, size_t padding = 0) const {
+    std::string pad(padding, ' ');
+    std::cout << pad << name << " = [\n";
+    for (size_t i = 0; i < rows; ++i) {
+      std::cout << pad << "    ";
+      for (size_t j = 0; j < cols; ++j) {
+        std::cout << (*this)(i, j) << " ";
+      }
+      std::cout << "\n";
+    }
+    std::cout << pad << "]\n";
+  }
+};
+
+// Row-major matrix stored as T (float, bf16 or fp16). Reduced-precision
+// copies of weights halve the bytes a GEMM has to stream for B; Matrix
+// stays the fp32 type everything computes in, and each element converts
+// to and from it exactly as convert() does.
+template <typename T>
+struct TypedMatrix {
+  size_t rows = 0;
+  size_t cols = 0;
+  std::vector<T> data;
+
+  TypedMatrix() = default;
+  explicit TypedMatrix(MatrixView m) { assign(m); }
+
+  // rounds m into this matrix, reusing the buffer
+  void assign(MatrixView m) {
+    rows = m.rows;
+    cols = m.cols;
+    data.resize(rows * cols);
+    for (size_t i = 0; i < rows; ++i) {
+      convert(m.row(i), data.data() + i * cols, cols);
+    }
+  }
+
+  float operator()(size_t i, size_t j) const {
+    assert(i < rows && j < cols);
+    float x;
+    convert(&data[i * cols + j], &x, 1);
+    return x;
+  }
+
+  void to_matrix(Matrix& dst) const {
+    dst.resize(rows, cols);
+    convert(data.data(), dst.data.data(), data.size());
+  }
+
+  size_t bytes() const { return data.size() * sizeof(T); }
+};
+
+// Dense linear algebra: LU and Cholesky factorizations and the triangular
+// solves built on them. All blocked the same way: a narrow panel of
+// kBlock columns is factored with plain loops, and the rest of the matrix
+// is updated by one GEMM per panel (alpha = -1, beta = 1), which is where
+// nearly all the flops go. Matrices are row-major like Matrix.
+namespace linalg {
+
+constexpr size_t kBlock = 96;
+// pivots below this are treated as zero (matches the old Gauss-Jordan
+// inverse)
+constexpr float kSingularEps = 1e-8f;
+
+// y[0..n) += a * x[0..n)
+inline void axpy(size_t n, float a, const float* x, float* y) {
+  using gemm::kVecWidth;
+  size_t j = 0;
+  for (; j + kVecWidth <= n; j += kVecWidth) {
+    gemm::store(y + j, gemm::load(y + j) + gemm::load(x + j) * a);
+  }
+  for (; j < n; ++j) {
+    y[j] += a * x[j];
+  }
+}
+
+using gemm::dot;
+
+inline void swap_rows(float* a, float* b, size_t n) {
+  std::swap_ranges(a, a + n, b);
+}
+
+// B = L^-1 B for L n x n lower triangular, B n x m; the diagonal of L is
+// taken as ones when unit is set (LU keeps U's diagonal there)
+inline void solve_lower(size_t n, size_t m, const float* l, size_t ldl,
+                        bool unit, float* b, size_t ldb) {
+  if (m == 1 && ldb == 1) {
+    // one right-hand side: a dot product along each row of L
+    for (size_t i = 0; i < n; ++i) {
+      float s = b[i] - dot(i, l + i * ldl, b);
+      b[i] = unit ? s : s / l[i * ldl + i];
+    }
+    return;
+  }
+  for (size_t ib = 0; ib < n; ib += kBlock) {
+    size_t nb = std::min(kBlock, n - ib);
+    // everything already solved, in one GEMM
+    sgemm(nb, m, ib, -1.0f, l + ib * ldl, ldl, b, ldb, 1.0f, b + ib * ldb,
+          ldb);
+    for (size_t i = ib; i < ib + nb; ++i) {
+      float* bi = b + i * ldb;
+      for (size_t p = ib; p < i; ++p) {
+        axpy(m, -l[i * ldl + p], b + p * ldb, bi);
+      }
+      if (!unit) {
+        float inv = 1.0f / l[i * ldl + i];
+        for (size_t j = 0; j < m; ++j) {
+          bi[j] *= inv;
+        }
+      }
+    }
+  }
+}
+
+// B = U^-1 B for U n x n upper triangular, B n x m
+inline void solve_upper(size_t n, size_t m, const float* u, size_t ldu,
+                        float* b, size_t ldb) {
+  if (m == 1 && ldb == 1) {
+    for (size_t i = n; i-- > 0;) {
+      const float* ui = u + i * ldu;
+      b[i] = (b[i] - dot(n - i - 1, ui + i + 1, b + i + 1)) / ui[i];
+    }
+    return;
+  }
+  for (size_t end = n; end > 0;) {
+    size_t ib = end > kBlock ? end - kBlock : 0;
+    sgemm(end - ib, m, n - end, -1.0f, u + ib * ldu + end, ldu,
+          b + end * ldb, ldb, 1.0f, b + ib * ldb, ldb);
+    for (size_t i = end; i-- > ib;) {
+      float* bi = b + i * ldb;
+      for (size_t p = i + 1; p < end; ++p) {
+        axpy(m, -u[i * ldu + p], b + p * ldb, bi);
+      }
+      float inv = 1.0f / u[i * ldu + i];
+      for (size_t j = 0; j < m; ++j) {
+        bi[j] *= inv;
+      }
+    }
+    end = ib;
+  }
+}
+
+}  // namespace linalg
+
+// P A = L U with partial pivoting, for solving square systems. L (unit
+// diagonal, not stored) and U share one n x n matrix; piv[i] is the row
+// that was swapped with row i at step i.
+//
+// Right-looking blocked factorization: each kBlock-wide column panel is
+// factored with row swaps applied to whole rows (contiguous in row-major),
+// the panel's U rows are solved against its L, and the trailing matrix
+// gets A22 -= L21 . U12 through sgemm. That is about 2n^3 / 3 flops, most
+// of them in the GEMM.
+class LU {
+ public:
+  Matrix lu;
+  std::vector<size_t> piv;
+  int sign = 1;  // of the permutation, for the determinant
+
+  // nullopt if a is not square or (numerically) singular
+  static std::optional<LU> factor(MatrixView a) {
+    if (a.rows != a.cols || a.rows == 0) {
+      return std::nullopt;
+    }
+    size_t n = a.rows;
+    LU f;
+    f.lu.resize(n, n);
+    for (size_t i = 0; i < n; ++i) {
+      std::copy(a.row(i), a.row(i) + n, &f.lu.data[i * n]);
+    }
+    f.piv.resize(n);
+    float* m = f.lu.data.data();
+    for (size_t kb = 0; kb < n; kb += linalg::kBlock) {
+      size_t nb = std::min(linalg::kBlock, n - kb);
+      size_t end = kb + nb;
+      // panel: columns [kb, end) of rows [kb, n)
+      for (size_t j = kb; j < end; ++j) {
+        size_t p = j;
+        for (size_t i = j + 1; i < n; ++i) {
+          if (std::abs(m[i * n + j]) > std::abs(m[p * n + j])) {
+            p = i;
+          }
+        }
+        f.piv[j] = p;
+        if (p != j) {
+          linalg::swap_rows(m + j * n, m + p * n, n);
+          f.sign = -f.sign;
+        }
+        float pivot = m[j * n + j];
+        if (std::abs(pivot) < linalg::kSingularEps) {
+          return std::nullopt;
+        }
+        float inv = 1.0f / pivot;
+        for (size_t i = j + 1; i < n; ++i) {
+          float* row = m + i * n;
+          row[j] *= inv;
+          linalg::axpy(end - j - 1, -row[j], m + j * n + j + 1, row + j + 1);
+        }
+      }
+      if (end == n) {
+        break;
+      }
+      // U12 = L11^-1 A12
+      for (size_t i = kb + 1; i < end; ++i) {
+        for (size_t p = kb; p < i; ++p) {
+          linalg::axpy(n - end, -m[i * n + p], m + p * n + end,
+                       m + i * n + end);
+        }
+      }
+      // A22 -= L21 . U12
+      sgemm(n - end, n - end, nb, -1.0f, m + end * n + kb, n, m + kb * n + end,
+            n, 1.0f, m + end * n + end, n);
+    }
+    return f;
+  }
+
+  size_t size() const { return lu.rows; }
+
+  // B = A^-1 B in place (B is n x m: m right-hand sides)
+  void solve_into(Matrix& b) const {
+    assert(b.rows == size());
+    size_t n = size();
+    for (size_t i = 0; i < n; ++i) {
+      if (piv[i] != i) {
+        linalg::swap_rows(&b.data[i * b.cols], &b.data[piv[i] * b.cols],
+                          b.cols);
+      }
+    }
+    linalg::solve_lower(n, b.cols, lu.data.data(), n, true, b.data.data(),
+                        b.cols);
+    linalg::solve_upper(n, b.cols, lu.data.data(), n, b.data.data(), b.cols);
+  }
+
+  Matrix solve(MatrixView b) const {
+    Matrix x(b.rows, b.cols);
+    for (size_t i = 0; i < b.rows; ++i) {
+      std::copy(b.row(i), b.row(i) + b.cols, &x.data[i * b.cols]);
+    }
+    solve_into(x);
+    return x;
+  }
+
+  Matrix inverse() const {
+    Matrix inv(size(), size(), 0.0f);
+    for (size_t i = 0; i < size(); ++i) {
+      inv(i, i) = 1.0f;
+    }
+    solve_into(inv);
+    return inv;
+  }
+
+  // product of U's diagonal, accumulated in double; over- or underflows
+  // float for big n, where log_abs_determinant() does not
+  float determinant() const {
+    double det = sign;
+    for (size_t i = 0; i < size(); ++i) {
+      det *= lu(i, i);
+    }
+    return float(det);
+  }
+
+  float log_abs_determinant() const {
+    double sum = 0.0;
+    for (size_t i = 0; i < size(); ++i) {
+      sum += std::log(std::abs(double(lu(i, i))));
+    }
+    return float(sum);
+  }
+};
+
+// A = L L^T for symmetric positive definite A: half the flops of LU, no
+// pivoting, and it fails exactly when A is not (numerically) SPD. Only the
+// lower triangle of A is read. Blocked like LU: factor the diagonal block,
+// solve the rows below it against it, then A22 -= L21 . L21^T over the
+// lower triangle, one block row of sgemm at a time.
+class Cholesky {
+ public:
+  Matrix l;  // lower triangular, zeros above the diagonal
+
+  static std::optional<Cholesky> factor(MatrixView a) {
+    if (a.rows != a.cols || a.rows == 0) {
+      return std::nullopt;
+    }
+    size_t n = a.rows;
+    Cholesky f;
+    f.l.resize(n, n);
+    for (size_t i = 0; i < n; ++i) {
+      std::copy(a.row(i), a.row(i) + i + 1, &f.l.data[i * n]);
+      std::fill(&f.l.data[i * n + i + 1], &f.l.data[i * n + n], 0.0f);
+    }
+    float* m = f.l.data.data();
+    Matrix t;  // L21^T of the current panel
+    for (size_t kb = 0; kb < n; kb += linalg::kBlock) {
+      size_t nb = std::min(linalg::kBlock, n - kb);
+      size_t end = kb + nb;
+      // diagonal block, unblocked
+      for (size_t i = kb; i < end; ++i) {
+        float* ri = m + i * n;
+        for (size_t j = kb; j <= i; ++j) {
+          const float* rj = m + j * n;
+          float s = ri[j];
+          for (size_t p = kb; p < j; ++p) {
+            s -= ri[p] * rj[p];
+          }
+          if (j < i) {
+            ri[j] = s / rj[j];
+          } else if (s > 0.0f) {
+            ri[j] = std::sqrt(s);
+          } else {
+            return std::nullopt;
+          }
+        }
+      }
+      if (end == n) {
+        break;
+      }
+      // L21 = A21 L11^-T, solved transposed (L21^T = L11^-1 A21^T) so the
+      // inner loops run along rows; the trailing update wants L21^T anyway
+      Matrix::transpose_into(t, f.l.block(end, kb, n - end, nb));
+      linalg::solve_lower(nb, t.cols, m + kb * n + kb, n, false, t.data.data(),
+                          t.cols);
+      for (size_t i = end; i < n; ++i) {
+        for (size_t j = 0; j < nb; ++j) {
+          m[i * n + kb + j] = t.data[j * t.cols + i - end];
+        }
+      }
+      // A22 -= L21 . L21^T, lower triangle only: block row ib stops at its
+      // diagonal block
+      for (size_t ib = end; ib < n; ib += linalg::kBlock) {
+        size_t rows = std::min(linalg::kBlock, n - ib);
+        sgemm(rows, ib + rows - end, nb, -1.0f, m + ib * n + kb, n,
+              t.data.data(), t.cols, 1.0f, m + ib * n + end, n);
+      }
+    }
+    // the GEMMs wrote a little past the diagonal in each block row
+    for (size_t i = 0; i < n; ++i) {
+      std::fill(&f.l.data[i * n + i + 1], &f.l.data[i * n + n], 0.0f);
+    }
+    f.l.transpose_into(f.lt);
+    return f;
+  }
+
+  size_t size() const { return l.rows; }
+
+  // B = A^-1 B in place: L y = b, then L^T x = y
+  void solve_into(Matrix& b) const {
+    assert(b.rows == size());
+    size_t n = size();
+    linalg::solve_lower(n, b.cols, l.data.data(), n, false, b.data.data(),
+                        b.cols);
+    linalg::solve_upper(n, b.cols, lt.data.data(), n, b.data.data(), b.cols);
+  }
+
+  Matrix solve(MatrixView b) const {
+    Matrix x(b.rows, b.cols);
+    for (size_t i = 0; i < b.rows; ++i) {
+      std::copy(b.row(i), b.row(i) + b.cols, &x.data[i * b.cols]);
+    }
+    solve_into(x);
+    return x;
+  }
+
+  Matrix inverse() const {
+    Matrix inv(size(), size(), 0.0f);
+    for (size_t i = 0; i < size(); ++i) {
+      inv(i, i) = 1.0f;
+    }
+    solve_into(inv);
+    return inv;
+  }
+
+  float determinant() const {
+    double det = 1.0;
+    for (size_t i = 0; i < size(); ++i) {
+      det *= double(l(i, i)) * l(i, i);
+    }
+    return float(det);
+  }
+
+  float log_abs_determinant() const {
+    double sum = 0.0;
+    for (size_t i = 0; i < size(); ++i) {
+      sum += 2.0 * std::log(double(l(i, i)));
+    }
+    return float(sum);
+  }
+
+ private:
+  Matrix lt;  // L^T, so the second solve reads rows too
+};
+
+// the Matrix members that need the factorizations above
+
+// an empty Matrix if this is not square or is singular
+inline Matrix Matrix::inverse() const {
+  auto f = LU::factor(view());
+  return f ? f->inverse() : Matrix();
+}
+
+// 0 if singular
+inline float Matrix::determinant() const {
+  auto f = LU::factor(view());
+  return f ? f->determinant() : 0.0f;
+}
+
+// X with A X = B for square A = *this; nullopt if A is singular
+inline std::optional<Matrix> Matrix::solve(MatrixView b) const {
+  auto f = LU::factor(view());
+  if (!f) {
+    return std::nullopt;
+  }
+  return f->solve(b);
+}
+
+// Optimizers
+//
+// Parameter updates applied after backprop. Every tensor (each ws[l] and
+// bs[l]) is updated in one pass that reads the gradient and the state and
+// writes the weight and the state, W lanes at a time on the same
+// AVX-512 / AVX2 / SSE dispatch as the activation kernels. With g the
+// gradient (plus weight_decay * w, except for AdamW):
+//   Sgd       w -= rate * g
+//   Momentum  m = beta1 * m + g;  w -= rate * m
+//   Nesterov  m = beta1 * m + g;  w -= rate * (g + beta1 * m)
+//   RMSProp   v = beta2 * v + (1 - beta2) * g^2;
+//             w -= rate * g / (sqrt(v) + eps)
+//   Adam      m = beta1 * m + (1 - beta1) * g;  v as RMSProp;
+//             w -= rate * m^ / (sqrt(v^) + eps), bias-corrected m^, v^
+//   AdamW     Adam, with weight decay applied to w directly
+namespace optim {
+
+enum class Kind { Sgd, Momentum, Nesterov, RMSProp, Adam, AdamW };
+
+// per-step constants, bias corrections already folded in
+struct Step {
+  float rate, beta1, beta2, eps, decay;  // decay: L2 on g
+  float shrink;                          // w *= shrink first (AdamW)
+  float m_scale, v_scale;                // 1 / (1 - beta^t), 1 / sqrt(...)
+};
+
+// one element; also the exact (std::sqrt) path for tails / NN_EXACT_MATH
+template <Kind K>
+NN_ALWAYS_INLINE void update_one(float& w, float g, float& m, float& v,
+                                 const Step& s) {
+  g += s.decay * w;
+  w *= s.shrink;
+  if constexpr (K == Kind::Sgd) {
+    w -= s.rate * g;
+  } else if constexpr (K == Kind::Momentum) {
+    m = s.beta1 * m + g;
+    w -= s.rate * m;
+  } else if constexpr (K == Kind::Nesterov) {
+    m = s.beta1 * m + g;
+    w -= s.rate * (g + s.beta1 * m);
+  } else if constexpr (K == Kind::RMSProp) {
+    v = s.beta2 * v + (1.0f - s.beta2) * g * g;
+    w -= s.rate * g / (std::sqrt(v) + s.eps);
+  } else {
+    m = s.beta1 * m + (1.0f - s.beta1) * g;
+    v = s.beta2 * v + (1.0f - s.beta2) * g * g;
+    w -= s.rate * m * s.m_scale / (std::sqrt(v) * s.v_scale + s.eps);
+  }
+}
+
+// vectors go through references, as in nn::simd
+template <typename F>
+NN_ALWAYS_INLINE void load(F& v, const float* p) {
+  std::memcpy(&v, p, sizeof(v));
+}
+
+template <typename F>
+NN_ALWAYS_INLINE void store(float* p, const F& v) {
+  std::memcpy(p, &v, sizeof(v));
+}
+
+template <Kind K, size_t W>
+NN_ALWAYS_INLINE void update(size_t n, float* w, const float* g, float* m,
+                             float* v, const Step& s) {
+  using F = typename simd::Vec<W>::f;
+  using I = typename simd::Vec<W>::i;
+  constexpr bool uses_m = K != Kind::Sgd && K != Kind::RMSProp;
+  constexpr bool uses_v = K == Kind::RMSProp || K >= Kind::Adam;
+  size_t i = 0;
+  for (; i + W <= n; i += W) {
+    F wv, gv, mv = {}, vv = {};
+    load(wv, w + i);
+    load(gv, g + i);
+    gv += wv * s.decay;
+    wv *= s.shrink;
+    if constexpr (uses_m) {
+      load(mv, m + i);
+    }
+    if constexpr (uses_v) {
+      load(vv, v + i);
+    }
+    if constexpr (K == Kind::Sgd) {
+      wv -= gv * s.rate;
+    } else if constexpr (K == Kind::Momentum) {
+      mv = mv * s.beta1 + gv;
+      wv -= mv * s.rate;
+    } else if constexpr (K == Kind::Nesterov) {
+      mv = mv * s.beta1 + gv;
+      wv -= (gv + mv * s.beta1) * s.rate;
+    } else {
+      vv = vv * s.beta2 + gv * gv * (1.0f - s.beta2);
+      F root = vv;
+      simd::sqrt<F, I>(root);
+      if constexpr (K == Kind::RMSProp) {
+        wv -= gv * s.rate / (root + s.eps);
+      } else {
+        mv = mv * s.beta1 + gv * (1.0f - s.beta1);
+        wv -= mv * (s.rate * s.m_scale) / (root * s.v_scale + s.eps);
+      }
+    }
+    store(w + i, wv);
+    if constexpr (uses_m) {
+      store(m + i, mv);
+    }
+    if constexpr (uses_v) {
+      store(v + i, vv);
+    }
+  }
+  for (; i < n; ++i) {
+    float unused = 0.0f;
+    update_one<K>(w[i], g[i], uses_m ? m[i] : unused, uses_v ? v[i] : unused,
+                  s);
+  }
+}
+
+template <Kind K>
+void update_generic(size_t n, float* w, const float* g, float* m, float* v,
+                    const Step& s) {
+  update<K, 4>(n, w, g, m, v, s);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+template <Kind K>
+__attribute__((target("avx2,fma"))) void update_avx2(size_t n, float* w,
+                                                     const float* g, float* m,
+                                                     float* v, const Step& s) {
+  update<K, 8>(n, w, g, m, v, s);
+}
+
+template <Kind K>
+__attribute__((target("avx512f"))) void update_avx512(size_t n, float* w,
+                                                      const float* g, float* m,
+                                                      float* v,
+                                                      const Step& s) {
+  update<K, 16>(n, w, g, m, v, s);
+}
+#endif
+
+template <Kind K>
+void run(size_t n, float* w, const float* g, float* m, float* v,
+         const Step& s) {
+#ifdef NN_EXACT_MATH
+  for (size_t i = 0; i < n; ++i) {
+    float unused = 0.0f;
+    update_one<K>(w[i], g[i], m ? m[i] : unused, v ? v[i] : unused, s);
+  }
+#else
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  simd::Level l = simd::level();
+  if (l == simd::Level::AVX512 && n >= 16) {
+    return update_avx512<K>(n, w, g, m, v, s);
+  }
+  if (l >= simd::Level::AVX2 && n >= 8) {
+    return update_avx2<K>(n, w, g, m, v, s);
+  }
+#endif
+  update_generic<K>(n, w, g, m, v, s);
+#endif
+}
+
+template <Kind K>
+using KindTag = std::integral_constant<Kind, K>;
+
+// calls fn(KindTag<K>{}) for the K matching kind
+template <typename F>
+decltype(auto) with_kind(Kind kind, F&& fn) {
+  switch (kind) {
+    case Kind::Sgd:
+      return fn(KindTag<Kind::Sgd>{});
+    case Kind::Momentum:
+      return fn(KindTag<Kind::Momentum>{});
+    case Kind::Nesterov:
+      return fn(KindTag<Kind::Nesterov>{});
+    case Kind::RMSProp:
+      return fn(KindTag<Kind::RMSProp>{});
+    case Kind::Adam:
+      return fn(KindTag<Kind::Adam>{});
+    case Kind::AdamW:
+      return fn(KindTag<Kind::AdamW>{});
+  }
+  assert(false && "unreachable");
+  return fn(KindTag<Kind::Sgd>{});
+}
+
+// for nn::prof: vector operations and bytes of w, g, m, v read or written
+// per element of one update
+constexpr const char* kind_name(Kind kind) {
+  constexpr const char* names[] = {"sgd",     "momentum", "nesterov",
+                                   "rmsprop", "adam",     "adamw"};
+  return names[int(kind)];
+}
+
+constexpr double flops(Kind kind) {
+  constexpr double per_element[] = {5, 7, 8, 12, 16, 16};
+  return per_element[int(kind)];
+}
+
+constexpr double bytes(Kind kind) {
+  bool uses_m = kind != Kind::Sgd && kind != Kind::RMSProp;
+  bool uses_v = kind == Kind::RMSProp || kind >= Kind::Adam;
+  return 12.0 + 8.0 * uses_m + 8.0 * uses_v;
+}
+
+}  // namespace optim
+
+// Scratch buffers for one training thread. Sized on first use and then
+// only resized in place, so once it has seen the largest batch a training
+// step does not touch the heap.
+struct Workspace {
+  std::vector<Matrix> as;   // activations of the current batch
+  std::vector<Matrix> zs;   // pre-activations of the current batch
+
+  void prepare(const std::vector<size_t>& arch) {
+    if (as.size() == arch.size()) {
+      return;
+    }
+    as.assign(arch.size(), Matrix());
+    zs.assign(arch.size() - 1, Matrix());
+  }
+};
+
+class NeuralNetwork {
+ public:
+  std::vector<size_t>
+      arch;                // Architecture it stores number of neuros per layer
+  std::vector<Matrix> ws;  // Weights
+  std::vector<Matrix> bs;  // Biases
+  std::vector<Matrix> as;  // Activations
+  std::vector<Matrix> zs;  // Pre-activations (before activation function)
+  std::vector<Activation> acts;  // activation of each layer after the input
+  Workspace work;                // scratch reused by backprop_into()
+
+  // Storage the forward pass reads the weights in. ws always holds the
+  // fp32 master weights that backprop and the updates work on; with BF16
+  // or FP16 the forward GEMMs read rounded copies of them instead (see
+  // set_precision()). Biases and activations stay fp32.
+  Precision precision = Precision::F32;
+  std::vector<TypedMatrix<bf16>> ws_bf16;
+  std::vector<TypedMatrix<fp16>> ws_fp16;
+
+  // One entry of a layer-by-layer description, e.g.
+  //   NeuralNetwork net({{784}, {128, Activation::Relu},
+  //                      {10, Activation::Softmax}});
+  // The input layer's activation is ignored.
+  struct Layer {
+    size_t size;
+    Activation act = NN_ACT;
+  };
+
+  // every layer uses the same activation
+  NeuralNetwork(const std::vector<size_t>& architecture,
+                Activation activation = NN_ACT)
+      : NeuralNetwork(architecture,
+                      std::vector<Activation>(
+                          architecture.empty() ? 0 : architecture.size() - 1,
+                          activation)) {}
+
+  // activations[i] is applied to layer i + 1
+  NeuralNetwork(const std::vector<size_t>& architecture,
+                const std::vector<Activation>& activations)
+      : arch(architecture), acts(activations) {
+    assert(arch.size() > 0);
+    assert(acts.size() == arch.size() - 1);
+
+    as.emplace_back(1, arch[0]);  // input layer for example if arch is {2 , 3 ,
+                                  // 1} then input matix should be 1x2
+    for (size_t i = 1; i < arch.size(); ++i) {
+      ws.emplace_back(arch[i - 1], arch[i]);
+      bs.emplace_back(1, arch[i]);
+      as.emplace_back(1, arch[i]);
+      zs.emplace_back(1, arch[i]);
+    }
+  }
+
+  explicit NeuralNetwork(const std::vector<Layer>& layers)
+      : NeuralNetwork(layer_sizes(layers), layer_acts(layers)) {}
+
+  Matrix& get_input() { return as.front(); }
+  Matrix& get_output() { return as.back(); }
+
+  const Matrix& get_output() const { return as.back(); }
+  void zero() {
+    for (auto& a : as) {
+      a.fill(0.0f);
+    }
+    for (auto& w : ws) {
+      w.fill(0.0f);
+    }
+    for (auto& b : bs) {
+      b.fill(0.0f);
+    }
+    for (auto& z : zs) {
+      z.fill(0.0f);
+    }
+    round_weights();
+  }
+
+  void randomize(float low, float high) {
+    for (auto& a : as) {
+      a.randomize(low, high);
+    }
+    for (auto& w : ws) {
+      w.randomize(low, high);
+    }
+    for (auto& b : bs) {
+      b.randomize(low, high);
+    }
+    round_weights();
+  }
+
+  // switches the forward pass to weights stored as p; the master weights
+  // are left alone
+  void set_precision(Precision p) {
+    precision = p;
+    ws_bf16.clear();
+    ws_fp16.clear();
+    round_weights();
+  }
+
+  // re-rounds the reduced-precision copies from ws. learn() and
+  // Optimizer::step() do this after every update; call it after changing
+  // ws any other way.
+  void round_weights() {
+    if (precision == Precision::BF16) {
+      ws_bf16.resize(ws.size());
+      for (size_t i = 0; i < ws.size(); ++i) {
+        ws_bf16[i].assign(ws[i]);
+      }
+    } else if (precision == Precision::FP16) {
+      ws_fp16.resize(ws.size());
+      for (size_t i = 0; i < ws.size(); ++i) {
+        ws_fp16[i].assign(ws[i]);
+      }
+    }
+  }
+
+  void print(const std::string& name = "nn") const {
+    std::cout << name << " = [\n";
+    for (size_t i = 0; i < ws.size(); ++i) {
+      ws[i].print("ws" + std::to_string(i), 4);
+      bs[i].print("bs" + std::to_string(i), 4);
+    }
+    std::cout << "]\n";
+  }
+
+  // runs every row of the input as one sample, so a B x arch[0] input
+  // gives B x arch[l] activations and one GEMM per layer
+  void forward() { forward_into(as.front(), as, zs); }
+
+  // forward() straight from a view (as[0] is left alone)
+  void forward(MatrixView input) { forward_into(input, as, zs); }
+
+  // forward() on caller-owned activation buffers; as[0] is not read, the
+  // first layer reads input directly
+  void forward_into(MatrixView input, std::vector<Matrix>& as,
+                    std::vector<Matrix>& zs) const {
+    assert(input.cols == arch.front());
+    for (size_t i = 0; i < ws.size(); i++) {
+      // pre-activation values are saved in zs for backprop
+      layer_into(i, as[i + 1], i == 0 ? input : as[i].view(), &zs[i]);
+    }
+  }
+
+  // forward_into() for inference: no pre-activation copies are kept, so
+  // only as[1..] is written
+  void infer_into(MatrixView input, std::vector<Matrix>& as) const {
+    assert(input.cols == arch.front());
+    for (size_t i = 0; i < ws.size(); i++) {
+      layer_into(i, as[i + 1], i == 0 ? input : as[i].view());
+    }
+  }
+
+  // forward(input) without touching zs
+  void infer(MatrixView input) { infer_into(input, as); }
+
+  // rows of t are pushed through forward() this many at a time
+  static constexpr size_t kCostBatch = 256;
+
+  // mean squared error over the rows of t
+  float cost(MatrixView t) { return evaluate(t, work); }
+
+  // cost(t) on caller-owned buffers: forward passes without gradients, so
+  // no pre-activations are stored, and as / get_output() are left alone.
+  // Safe to run from several threads with one Workspace each.
+  float evaluate(MatrixView t, Workspace& w) const {
+    assert(arch.front() + arch.back() == t.cols);
+    const size_t in_cols = arch.front();
+    const size_t out_cols = arch.back();
+    w.prepare(arch);
+    float c = 0.0f;
+    size_t n = t.rows;
+    for (size_t begin = 0; begin < n; begin += kCostBatch) {
+      size_t batch = std::min(kCostBatch, n - begin);
+      infer_into(t.block(begin, 0, batch, in_cols), w.as);
+
+      // we need to get output the true value
+      for (size_t i = 0; i < batch; ++i) {
+        const float* out = &w.as.back().data[i * out_cols];
+        const float* true_vals = t.row(begin + i) + in_cols;
+        for (size_t j = 0; j < out_cols; ++j) {
+          float d = out[j] - true_vals[j];
+          c += d * d;
+        }
+      }
+    }
+    return c / n;
+  }
+
+  // Gradient of cost(t), averaged over the rows of t
+  NeuralNetwork backprop(MatrixView t) {
+    NeuralNetwork g(arch);
+    backprop_into(t, g);
+    return g;
+  }
+
+  // backprop() into an existing gradient network, using this network's
+  // own workspace; returns cost(t), taken from the same forward pass
+  float backprop_into(MatrixView t, NeuralNetwork& g) {
+    return backprop_into(t, g, work);
+  }
+
+  // Works on kCostBatch rows at a time. g.ws/g.bs are overwritten with the
+  // gradients; g.as[l] and g.zs[l - 1] are left holding dC/da and dC/dz of
+  // the last batch. Per layer that is
+  //   dZ = s * dA * act'(Z)    gb += colsum(dZ)
+  //   gW += A^T . dZ           dA_prev = dZ . W^T
+  // with both transposes read in place by the GEMM (Trans::T), so neither
+  // A^T nor W^T is ever materialized. The return value is cost(t) before
+  // the update, read off the forward pass backprop needs anyway.
+  float backprop_into(MatrixView t, NeuralNetwork& g, Workspace& w) const {
+    size_t n = t.rows;
+    assert(arch.front() + arch.back() == t.cols);
+    assert(g.arch == arch);
+    const size_t in_cols = arch.front();
+    const size_t out_cols = arch.back();
+
+    for (size_t l = 0; l < ws.size(); ++l) {
+      g.ws[l].fill(0.0f);
+      g.bs[l].fill(0.0f);
+    }
+    w.prepare(arch);
+
+#ifdef NN_BACKPROP_TRADITIONAL
+    float c = 2.0f;
+    float s = 1.0f;
+#else
+    float c = 1.0f;
+    float s = 2.0f;
+#endif
+
+    float cost = 0.0f;
+    for (size_t begin = 0; begin < n; begin += kCostBatch) {
+      size_t batch = std::min(kCostBatch, n - begin);
+      MatrixView in = t.block(begin, 0, batch, in_cols);
+
+      forward_into(in, w.as, w.zs);
+
+      Matrix& da = g.get_output();
+      da.resize(batch, out_cols);
+      {
+        NN_PROFILE_SCOPE("loss", int(ws.size()) - 1, prof::Phase::Backward,
+                         4.0 * batch * out_cols, 12.0 * batch * out_cols);
+        for (size_t i = 0; i < batch; ++i) {
+          const float* out = t.row(begin + i) + in_cols;
+          for (size_t j = 0; j < out_cols; ++j) {
+            float d = w.as.back()(i, j) - out[j];
+            cost += d * d;
+            da(i, j) = c * d;
+          }
+        }
+      }
+
+      for (size_t l = arch.size() - 1; l > 0; --l) {
+        Matrix& dz = g.zs[l - 1];
+        dz.resize(batch, arch[l]);
+        {
+          // reads dA, A and Z, writes dZ
+          NN_PROFILE_SCOPE("activation_grad", int(l - 1),
+                           prof::Phase::Backward, 3.0 * batch * arch[l],
+                           16.0 * batch * arch[l]);
+          with_activation(acts[l - 1], [&](auto a) {
+            activation_grad<decltype(a)>(dz.data.data(), g.as[l].data.data(),
+                                         w.as[l].data.data(),
+                                         w.zs[l - 1].data.data(), s, batch,
+                                         arch[l]);
+          });
+        }
+
+        {
+          NN_PROFILE_SCOPE("bias_grad", int(l - 1), prof::Phase::Backward,
+                           double(batch) * arch[l],
+                           4.0 * (batch + 2.0) * arch[l]);
+          float* gb = g.bs[l - 1].data.data();
+          for (size_t i = 0; i < batch; ++i) {
+            const float* row = &dz.data[i * arch[l]];
+            for (size_t j = 0; j < arch[l]; ++j) {
+              gb[j] += row[j];
+            }
+          }
+        }
+
+        {
+          NN_PROFILE_SCOPE("weight_grad", int(l - 1), prof::Phase::Backward,
+                           2.0 * batch * arch[l - 1] * arch[l],
+                           4.0 * (double(batch) * (arch[l - 1] + arch[l]) +
+                                  2.0 * arch[l - 1] * arch[l]));
+          MatrixView a = l > 1 ? w.as[l - 1].view() : in;
+          sgemm(Trans::T, Trans::N, arch[l - 1], arch[l], batch, 1.0f,
+                a.data, a.stride, dz.data.data(), arch[l], 1.0f,
+                g.ws[l - 1].data.data(), arch[l]);
+        }
+
+        // the input layer has no use for its gradient
+        if (l > 1) {
+          NN_PROFILE_SCOPE("input_grad", int(l - 1), prof::Phase::Backward,
+                           2.0 * batch * arch[l - 1] * arch[l],
+                           4.0 * (double(batch) * (arch[l - 1] + arch[l]) +
+                                  double(arch[l - 1]) * arch[l]));
+          Matrix& da_prev = g.as[l - 1];
+          da_prev.resize(batch, arch[l - 1]);
+          sgemm(Trans::N, Trans::T, batch, arch[l - 1], arch[l], 1.0f,
+                dz.data.data(), arch[l], ws[l - 1].data.data(), arch[l], 0.0f,
+                da_prev.data.data(), arch[l - 1]);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < g.ws.size(); ++i) {
+      NN_PROFILE_SCOPE("average", int(i), prof::Phase::Backward,
+                       double(g.ws[i].data.size() + g.bs[i].data.size()),
+                       8.0 * (g.ws[i].data.size() + g.bs[i].data.size()));
+      for (auto& x : g.ws[i].data) {
+        x /= n;
+      }
+      for (auto& x : g.bs[i].data) {
+        x /= n;
+      }
+    }
+    return cost / n;
+  }
+
+  // One training iteration: backprop_into(t, g), then the update, which is
+  // learn(g, rate) for a learning rate or opt.step(*this, g) for an
+  // Optimizer. g is left holding the gradient; the return value is the
+  // loss of t before the update, from the same forward pass.
+  template <typename R>
+  float train_step(MatrixView t, NeuralNetwork& g, R&& rate_or_opt) {
+    float loss = backprop_into(t, g);
+    if constexpr (std::is_arithmetic_v<std::remove_cvref_t<R>>) {
+      learn(g, rate_or_opt);
+    } else {
+      rate_or_opt.step(*this, g);
+    }
+    return loss;
+  }
+
+  // plain SGD step: ws -= rate * g.ws, bs -= rate * g.bs (see Optimizer
+  // for the others)
+  void learn(const NeuralNetwork& g, float rate) {
+    optim::Step s{rate, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+    for (size_t i = 0; i < ws.size(); ++i) {
+      NN_PROFILE_SCOPE("sgd", int(i), prof::Phase::Update,
+                       optim::flops(optim::Kind::Sgd) *
+                           (ws[i].data.size() + bs[i].data.size()),
+                       optim::bytes(optim::Kind::Sgd) *
+                           (ws[i].data.size() + bs[i].data.size()));
+      optim::run<optim::Kind::Sgd>(ws[i].data.size(), ws[i].data.data(),
+                                   g.ws[i].data.data(), nullptr, nullptr, s);
+      optim::run<optim::Kind::Sgd>(bs[i].data.size(), bs[i].data.data(),
+                                   g.bs[i].data.data(), nullptr, nullptr, s);
+    }
+    round_weights();
+  }
+
+ private:
+  // layer i of the forward pass, on the weights in this net's precision
+  void layer_into(size_t i, Matrix& out, MatrixView in,
+                  Matrix* z = nullptr) const {
+    // one step: the GEMM, bias, activation and z copy are fused per tile
+    NN_PROFILE_SCOPE("dense", int(i), prof::Phase::Forward,
+                     (2.0 * arch[i] + 1.0) * in.rows * arch[i + 1],
+                     layer_bytes(i, in.rows, z != nullptr));
+    switch (precision) {
+      case Precision::F32:
+        return Matrix::layer_into(out, in, ws[i], bs[i], acts[i], z);
+      case Precision::BF16:
+        assert(ws_bf16.size() == ws.size());
+        return Matrix::layer_into(out, in, ws_bf16[i], bs[i], acts[i], z);
+      case Precision::FP16:
+        assert(ws_fp16.size() == ws.size());
+        return Matrix::layer_into(out, in, ws_fp16[i], bs[i], acts[i], z);
+    }
+  }
+
+  // x, W (in this net's precision) and b read, a (and z) written
+  double layer_bytes(size_t i, size_t rows, bool z) const {
+    double w = precision == Precision::F32 ? 4.0 : 2.0;
+    return 4.0 * (double(rows) * arch[i] + arch[i + 1] +
+                  (z ? 2.0 : 1.0) * rows * arch[i + 1]) +
+           w * arch[i] * arch[i + 1];
+  }
+
+  static std::vector<size_t> layer_sizes(const std::vector<Layer>& layers) {
+    std::vector<size_t> sizes;
+    for (const auto& l : layers) {
+      sizes.push_back(l.size);
+    }
+    return sizes;
+  }
+
+  static std::vector<Activation> layer_acts(const std::vector<Layer>& layers) {
+    std::vector<Activation> out;
+    for (size_t i = 1; i < layers.size(); ++i) {
+      out.push_back(layers[i].act);
+    }
+    return out;
+  }
+};
+
+// Optimizer state for one network. The m / v buffers are sized on the
+// first step() and reused after that. Stepping a network of another shape
+// starts the state over; call reset() (or make a new Optimizer) to train
+// another network of the same shape.
+//   nn::Optimizer opt = nn::Optimizer::adam(1e-3f);
+//   net.backprop_into(t, g);
+//   opt.step(net, g);
+struct Optimizer {
+  using Kind = optim::Kind;
+
+  Kind kind;
+  float rate;
+  float beta1;  // momentum / first moment decay
+  float beta2;  // second moment decay
+  float eps;
+  float weight_decay;
+  size_t steps = 0;       // updates so far, for Adam's bias correction
+  std::vector<Matrix> m;  // ws[0], bs[0], ws[1], bs[1], ...
+  std::vector<Matrix> v;
+
+  explicit Optimizer(Kind kind = Kind::Sgd, float rate = 0.01f,
+                     float beta1 = 0.9f, float beta2 = 0.999f,
+                     float eps = 1e-8f, float weight_decay = 0.0f)
+      : kind(kind),
+        rate(rate),
+        beta1(beta1),
+        beta2(beta2),
+        eps(eps),
+        weight_decay(weight_decay) {}
+
+  static Optimizer sgd(float rate) { return Optimizer(Kind::Sgd, rate); }
+  static Optimizer momentum(float rate, float beta = 0.9f) {
+    return Optimizer(Kind::Momentum, rate, beta);
+  }
+  static Optimizer nesterov(float rate, float beta = 0.9f) {
+    return Optimizer(Kind::Nesterov, rate, beta);
+  }
+  static Optimizer rmsprop(float rate, float decay = 0.9f) {
+    return Optimizer(Kind::RMSProp, rate, 0.0f, decay);
+  }
+  static Optimizer adam(float rate, float beta1 = 0.9f, float beta2 = 0.999f) {
+    return Optimizer(Kind::Adam, rate, beta1, beta2);
+  }
+  static Optimizer adamw(float rate, float weight_decay = 0.01f,
+                         float beta1 = 0.9f, float beta2 = 0.999f) {
+    return Optimizer(Kind::AdamW, rate, beta1, beta2, 1e-8f,
+                     weight_decay);
+  }
+
+  void reset() {
+    steps = 0;
+    m.clear();
+    v.clear();
+  }
+
+  // nn -= update(g); g has nn's architecture
+  void step(NeuralNetwork& nn, const NeuralNetwork& g) {
+    assert(g.arch == nn.arch);
+    bool uses_m = kind != Kind::Sgd && kind != Kind::RMSProp;
+    bool uses_v = kind == Kind::RMSProp || kind >= Kind::Adam;
+    if ((uses_m && !fits(m, nn)) || (uses_v && !fits(v, nn))) {
+      reset();
+      if (uses_m) {
+        m = state_for(nn);
+      }
+      if (uses_v) {
+        v = state_for(nn);
+      }
+    }
+    ++steps;
+
+    optim::Step s{rate, beta1, beta2, eps, weight_decay, 1.0f, 1.0f, 1.0f};
+    if (kind >= Kind::Adam) {
+      float t = float(steps);
+      s.m_scale = 1.0f / (1.0f - std::pow(beta1, t));
+      s.v_scale = 1.0f / std::sqrt(1.0f - std::pow(beta2, t));
+    }
+    if (kind == Kind::AdamW) {
+      s.decay = 0.0f;
+      s.shrink = 1.0f - rate * weight_decay;
+    }
+
+    optim::with_kind(kind, [&](auto k) {
+      constexpr Kind K = decltype(k)::value;
+      for (size_t i = 0; i < 2 * nn.ws.size(); ++i) {
+        Matrix& w = i % 2 ? nn.bs[i / 2] : nn.ws[i / 2];
+        const Matrix& gw = i % 2 ? g.bs[i / 2] : g.ws[i / 2];
+        NN_PROFILE_SCOPE(optim::kind_name(K), int(i / 2),
+                         prof::Phase::Update,
+                         optim::flops(K) * w.data.size(),
+                         optim::bytes(K) * w.data.size());
+        optim::run<K>(w.data.size(), w.data.data(), gw.data.data(),
+                      uses_m ? m[i].data.data() : nullptr,
+                      uses_v ? v[i].data.data() : nullptr, s);
+      }
+    });
+    nn.round_weights();
+  }
+
+ private:
+  static std::vector<Matrix> state_for(const NeuralNetwork& nn) {
+    std::vector<Matrix> out;
+    for (size_t l = 0; l < nn.ws.size(); ++l) {
+      out.emplace_back(nn.ws[l].rows, nn.ws[l].cols, 0.0f);
+      out.emplace_back(nn.bs[l].rows, nn.bs[l].cols, 0.0f);
+    }
+    return out;
+  }
+
+  // state has one buffer of the right shape for every ws / bs of nn
+  static bool fits(const std::vector<Matrix>& state, const NeuralNetwork& nn) {
+    if (state.size() != 2 * nn.ws.size()) {
+      return false;
+    }
+    for (size_t l = 0; l < nn.ws.size(); ++l) {
+      const Matrix& w = state[2 * l];
+      const Matrix& b = state[2 * l + 1];
+      if (w.rows != nn.ws[l].rows || w.cols != nn.ws[l].cols ||
+          b.rows != nn.bs[l].rows || b.cols != nn.bs[l].cols) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Epoch-aware minibatch scheduler. Each epoch visits every row of t once,
+// in a fresh random order when shuffling (the default); the rows of a
+// shuffled batch are gathered into a reused buffer, t itself never moves.
+// Without shuffling batches are plain views of t. The reported cost comes
+// from the forward pass backprop already does, so it is the loss before
+// each step's update, averaged over the epoch's samples.
+//
+// Batch sizes: the last batch of an epoch holds whatever is left
+// (t.rows % batch_size rows) unless drop_last is set, in which case those
+// rows are skipped for that epoch; a batch_size larger than t gives one
+// batch of all of t, with or without drop_last.
+class Scheduler {
+ public:
+  bool drop_last = false;
+  size_t epoch = 0;      // completed epochs
+  float cost = 0.0f;     // mean loss of the last completed epoch
+  bool finished = false;  // the last step completed an epoch
+
+  explicit Scheduler(size_t batch_size, bool shuffle = true,
+                     uint64_t seed = std::random_device{}())
+      : batch_size(batch_size), shuffle(shuffle), rng(seed) {
+    assert(batch_size > 0);
+  }
+
+  // rows of the next minibatch of t; valid until the next call. Starts a
+  // new epoch when the previous one is done (or t changed size).
+  MatrixView next(MatrixView t) {
+    assert(t.rows > 0);
+    if (epoch_end || order.size() != t.rows) {
+      start_epoch(t.rows);
+    }
+    size_t size = std::min(batch_size, t.rows - pos);
+    size_t begin = pos;
+    pos += size;
+    size_t left = t.rows - pos;
+    epoch_end = left == 0 || (drop_last && left < batch_size);
+
+    if (!shuffle) {
+      return t.row_range(begin, size);
+    }
+    NN_PROFILE_SCOPE("gather_batch", -1, prof::Phase::Data, 0.0,
+                     8.0 * size * t.cols);
+    gathered.resize(size, t.cols);
+    for (size_t i = 0; i < size; ++i) {
+      const float* row = t.row(order[begin + i]);
+      std::copy(row, row + t.cols, &gathered.data[i * t.cols]);
+    }
+    return gathered;
+  }
+
+  // one train_step() on the next minibatch; rate_or_opt is a learning rate
+  // or an Optimizer&. Returns the minibatch's loss.
+  template <typename R>
+  float step(NeuralNetwork& nn, MatrixView t, R&& rate_or_opt) {
+    if (!g || g->arch != nn.arch) {
+      g.emplace(nn.arch);
+    }
+    MatrixView batch = next(t);
+    float loss = nn.train_step(batch, *g, rate_or_opt);
+    loss_sum += double(loss) * batch.rows;
+    loss_rows += batch.rows;
+    finished = epoch_end;
+    if (finished) {
+      cost = float(loss_sum / loss_rows);
+      ++epoch;
+    }
+    return loss;
+  }
+
+  // steps until the current epoch is done; returns its mean loss
+  template <typename R>
+  float run_epoch(NeuralNetwork& nn, MatrixView t, R&& rate_or_opt) {
+    do {
+      step(nn, t, rate_or_opt);
+    } while (!finished);
+    return cost;
+  }
+
+ private:
+  size_t batch_size;
+  bool shuffle;
+  std::mt19937_64 rng;
+  std::vector<size_t> order;  // row visiting order of this epoch
+  size_t pos = 0;
+  bool epoch_end = false;
+  Matrix gathered;
+  std::optional<NeuralNetwork> g;  // reused gradient
+  double loss_sum = 0.0;
+  size_t loss_rows = 0;
+
+  void start_epoch(size_t rows) {
+    if (order.size() != rows) {
+      order.resize(rows);
+      std::iota(order.begin(), order.end(), size_t{0});
+    }
+    if (shuffle) {
+      std::shuffle(order.begin(), order.end(), rng);
+    }
+    pos = 0;
+    epoch_end = false;
+    loss_sum = 0.0;
+    loss_rows = 0;
+  }
+};
+
+// Data-parallel minibatch SGD. Each step cuts the minibatch into `shards`
+// contiguous row ranges and backpropagates them on the pool, every shard
+// with its own workspace and gradient. The shard gradients are weighted by
+// their share of the rows and summed pairwise (0 += 1, 2 += 3, ..., then
+// 0 += 2, ...) before learn(). Shard boundaries and the reduction order only
+// depend on the shard count, so for a fixed count the weights come out
+// bit-identical no matter which threads ran which shard.
+class ParallelTrainer {
+ public:
+  // shards == 0 uses one shard per pool thread
+  explicit ParallelTrainer(size_t shards = 0)
+      : shards(shards ? shards : get_num_threads()) {}
+
+  size_t shard_count() const { return shards; }
+
+  // nn.cost(t) of the last gradient() call, from its forward pass
+  float loss() const { return last_loss; }
+
+  // gradient of nn.cost(t), averaged over the rows of t; stays valid until
+  // the next call
+  const NeuralNetwork& gradient(const NeuralNetwork& nn, MatrixView t) {
+    assert(t.rows > 0);
+    size_t used = std::min(shards, t.rows);
+    if (grads.size() < used) {
+      grads.resize(used, NeuralNetwork(nn.arch));
+      work.resize(used);
+      losses.resize(used);
+    }
+
+    thread_pool().parallel_for(used, [&](size_t i) {
+      size_t begin = i * t.rows / used;
+      size_t end = (i + 1) * t.rows / used;
+      NeuralNetwork& g = grads[i];
+      if (g.arch != nn.arch) {
+        g = NeuralNetwork(nn.arch);
+      }
+      float share = float(end - begin) / float(t.rows);
+      losses[i] =
+          share * nn.backprop_into(t.row_range(begin, end - begin), g, work[i]);
+      for (size_t l = 0; l < g.ws.size(); ++l) {
+        g.ws[l] *= share;
+        g.bs[l] *= share;
+      }
+    });
+
+    for (size_t stride = 1; stride < used; stride *= 2) {
+      size_t pairs = (used - stride + 2 * stride - 1) / (2 * stride);
+      thread_pool().parallel_for(pairs, [&](size_t p) {
+        NeuralNetwork& dst = grads[2 * stride * p];
+        const NeuralNetwork& src = grads[2 * stride * p + stride];
+        for (size_t l = 0; l < dst.ws.size(); ++l) {
+          dst.ws[l] += src.ws[l];
+          dst.bs[l] += src.bs[l];
+        }
+        losses[2 * stride * p] += losses[2 * stride * p + stride];
+      });
+    }
+    last_loss = losses.front();
+    return grads.front();
+  }
+
+  // one SGD step on every row of t; returns the loss before the step
+  float step(NeuralNetwork& nn, MatrixView t, float rate) {
+    nn.learn(gradient(nn, t), rate);
+    return last_loss;
+  }
+
+  float step(NeuralNetwork& nn, MatrixView t, Optimizer& opt) {
+    opt.step(nn, gradient(nn, t));
+    return last_loss;
+  }
+
+  // one pass over t in minibatches of batch_size rows, in order (shuffle
+  // with a Scheduler's next() and step() for that); returns the mean loss
+  template <typename R>
+  float epoch(NeuralNetwork& nn, MatrixView t, size_t batch_size,
+              R&& rate_or_opt) {
+    double sum = 0.0;
+    for (size_t begin = 0; begin < t.rows; begin += batch_size) {
+      size_t size = std::min(batch_size, t.rows - begin);
+      sum += double(step(nn, t.row_range(begin, size), rate_or_opt)) * size;
+    }
+    return float(sum / t.rows);
+  }
+
+ private:
+  size_t shards;
+  std::vector<NeuralNetwork> grads;  // one per shard, reduced into grads[0]
+  std::vector<Workspace> work;
+  std::vector<float> losses;  // per shard, reduced like grads
+  float last_loss = 0.0f;
+};
+
+// Asynchronous (Hogwild-style) SGD: the rows of t are split between
+// `workers` tasks on the pool, and every task runs backprop on its own
+// minibatches and subtracts its gradient from the shared ws/bs straight
+// away, without locks or a reduction.
+//
+// All shared weights are touched through relaxed std::atomic_ref loads and
+// stores, so there is no undefined behaviour, but there are two benign
+// races by design:
+//   - a worker's snapshot of the weights may mix values from before and
+//     after another worker's update (it is refreshed per minibatch)
+//   - the update is load / subtract / store, not an atomic RMW, so two
+//     workers writing the same weight at once can lose one of the steps
+// On dense-ish gradients the lost steps only add noise; on sparse ones
+// they are rare. Results are not reproducible run to run; use
+// ParallelTrainer when they need to be.
+class HogwildTrainer {
+ public:
+  // workers == 0 uses one per pool thread
+  explicit HogwildTrainer(size_t workers = 0)
+      : workers(workers ? workers : get_num_threads()) {}
+
+  size_t worker_count() const { return workers; }
+
+  // one pass over t, minibatches of batch_size rows per worker; returns
+  // the mean of the minibatch losses each worker saw before its updates
+  float epoch(NeuralNetwork& nn, MatrixView t, size_t batch_size,
+              float rate) {
+    assert(batch_size > 0);
+    size_t used = std::min(workers, t.rows);
+    if (state.size() < used) {
+      state.resize(used);
+    }
+
+    thread_pool().parallel_for(used, [&](size_t i) {
+      size_t begin = i * t.rows / used;
+      size_t end = (i + 1) * t.rows / used;
+      Worker& w = state[i];
+      if (!w.local || w.local->arch != nn.arch || w.local->acts != nn.acts) {
+        w.local.emplace(nn.arch, nn.acts);
+        w.grad.emplace(nn.arch);
+      }
+      w.loss = 0.0;
+      for (size_t b = begin; b < end; b += batch_size) {
+        MatrixView mb = t.row_range(b, std::min(batch_size, end - b));
+        snapshot(nn, *w.local);
+        // forward passes in the shared net's precision
+        w.local->precision = nn.precision;
+        w.local->round_weights();
+        float loss = w.local->backprop_into(mb, *w.grad, w.work);
+        w.loss += double(loss) * mb.rows;
+        update(nn, *w.grad, rate);
+      }
+    });
+    nn.round_weights();
+
+    double sum = 0.0;
+    for (size_t i = 0; i < used; ++i) {
+      sum += state[i].loss;
+    }
+    return float(sum / t.rows);
+  }
+
+ private:
+  struct Worker {
+    std::optional<NeuralNetwork> local;  // private copy of the weights
+    std::optional<NeuralNetwork> grad;
+    Workspace work;
+    double loss = 0.0;  // summed over this epoch's rows
+  };
+
+  size_t workers;
+  std::vector<Worker> state;
+
+  static void snapshot(NeuralNetwork& shared, NeuralNetwork& local) {
+    for (size_t l = 0; l < shared.ws.size(); ++l) {
+      copy_relaxed(shared.ws[l], local.ws[l]);
+      copy_relaxed(shared.bs[l], local.bs[l]);
+    }
+  }
+
+  static void copy_relaxed(Matrix& src, Matrix& dst) {
+    for (size_t i = 0; i < src.data.size(); ++i) {
+      dst.data[i] =
+          std::atomic_ref<float>(src.data[i]).load(std::memory_order_relaxed);
+    }
+  }
+
+  static void update(NeuralNetwork& shared, const NeuralNetwork& g,
+                     float rate) {
+    for (size_t l = 0; l < shared.ws.size(); ++l) {
+      step_relaxed(shared.ws[l], g.ws[l], rate);
+      step_relaxed(shared.bs[l], g.bs[l], rate);
+    }
+  }
+
+  static void step_relaxed(Matrix& x, const Matrix& g, float rate) {
+    for (size_t i = 0; i < x.data.size(); ++i) {
+      std::atomic_ref<float> v(x.data[i]);
+      v.store(v.load(std::memory_order_relaxed) - rate * g.data[i],
+              std::memory_order_relaxed);
+    }
+  }
+};
+
+// Read-only view of a whole file: a shared mmap where available, otherwise
+// the file read into memory. Move-only; data() stays put across moves.
+class MappedFile {
+ public:
+  static std::optional<MappedFile> open(const std::filesystem::path& path) {
+    MappedFile f;
+#ifdef NN_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return std::nullopt;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      return std::nullopt;
+    }
+    f.len = static_cast<size_t>(st.st_size);
+    void* p = mmap(nullptr, f.len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      return std::nullopt;
+    }
+    f.base = static_cast<const std::byte*>(p);
+#else
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+      return std::nullopt;
+    }
+    f.owned.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(f.owned.data()),
+            static_cast<std::streamsize>(f.owned.size()));
+    if (!in) {
+      return std::nullopt;
+    }
+    f.base = f.owned.data();
+    f.len = f.owned.size();
+#endif
+    return f;
+  }
+
+  MappedFile(MappedFile&& o) noexcept { *this = std::move(o); }
+
+  MappedFile& operator=(MappedFile&& o) noexcept {
+    if (this != &o) {
+      unmap();
+      owned = std::move(o.owned);
+      base = std::exchange(o.base, nullptr);
+      len = std::exchange(o.len, 0);
+    }
+    return *this;
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() { unmap(); }
+
+  const std::byte* data() const { return base; }
+  size_t size() const { return len; }
+
+ private:
+  MappedFile() = default;
+
+  const std::byte* base = nullptr;
+  size_t len = 0;
+  std::vector<std::byte> owned;  // only used without mmap
+
+  void unmap() {
+#ifdef NN_HAS_MMAP
+    if (base && owned.empty()) {
+      munmap(const_cast<std::byte*>(base), len);
+    }
+#endif
+    base = nullptr;
+  }
+};
+
+// Checkpoints
+//
+// Little-endian binary layout, version 1:
+//   CheckpointHeader
+//   uint64_t arch[layers]
+//   uint32_t acts[layers - 1]
+//   then, from data_offset, for every layer l: ws[l] (arch[l] x arch[l + 1])
+//   followed by bs[l] (1 x arch[l + 1]), each blob starting on an
+//   `alignment` boundary so a mapping can be used in place.
+// Values are stored in host byte order, which the checks below pin to
+// little-endian.
+static_assert(std::endian::native == std::endian::little,
+              "checkpoints are only read and written on little-endian hosts");
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;  // 0 = float32
+  uint32_t layers;
+  uint32_t alignment;
+  uint64_t data_offset;
+  uint64_t file_size;
+};
+
+constexpr char kCheckpointMagic[8] = {'t', 'i', 'n', 'y', 'n', 'n', 0, 0};
+constexpr uint32_t kCheckpointVersion = 1;
+constexpr uint32_t kCheckpointAlignment = 64;
+
+// where everything lives inside a checkpoint file
+struct CheckpointLayout {
+  std::vector<size_t> arch;
+  std::vector<Activation> acts;
+  std::vector<size_t> ws_offsets;
+  std::vector<size_t> bs_offsets;
+  size_t file_size = 0;
+
+  static size_t align(size_t x) {
+    return (x + kCheckpointAlignment - 1) / kCheckpointAlignment *
+           kCheckpointAlignment;
+  }
+
+  // false if the blobs do not fit in size_t, which only a crafted file's
+  // widths get to
+  bool compute_offsets() {
+    size_t offset = align(sizeof(CheckpointHeader) +
+                          arch.size() * sizeof(uint64_t) +
+                          acts.size() * sizeof(uint32_t));
+    // offset = align(offset + rows * cols floats), checked
+    auto advance = [&offset](size_t rows, size_t cols) {
+      if (offset > SIZE_MAX - kCheckpointAlignment) {
+        return false;
+      }
+      size_t room = SIZE_MAX - kCheckpointAlignment - offset;
+      if (cols > room / sizeof(float) ||
+          (cols != 0 && rows > room / (cols * sizeof(float)))) {
+        return false;
+      }
+      offset = align(offset + rows * cols * sizeof(float));
+      return true;
+    };
+    ws_offsets.clear();
+    bs_offsets.clear();
+    for (size_t l = 0; l + 1 < arch.size(); ++l) {
+      ws_offsets.push_back(offset);
+      if (!advance(arch[l], arch[l + 1])) {
+        return false;
+      }
+      bs_offsets.push_back(offset);
+      if (!advance(1, arch[l + 1])) {
+        return false;
+      }
+    }
+    file_size = offset;
+    return true;
+  }
+
+  // validates a header and everything it points at; nullopt on any
+  // mismatch, short file or unknown version
+  static std::optional<CheckpointLayout> parse(const std::byte* base,
+                                               size_t size) {
+    CheckpointHeader h;
+    if (size < sizeof(h)) {
+      return std::nullopt;
+    }
+    std::memcpy(&h, base, sizeof(h));
+    if (std::memcmp(h.magic, kCheckpointMagic, sizeof(h.magic)) != 0 ||
+        h.version != kCheckpointVersion || h.dtype != 0 || h.layers == 0 ||
+        h.alignment != kCheckpointAlignment || h.file_size != size) {
+      return std::nullopt;
+    }
+    // every layer takes 12 bytes of metadata, so this bounds layers
+    // before anything is multiplied by it
+    constexpr size_t kLayerMeta = sizeof(uint64_t) + sizeof(uint32_t);
+    if (h.layers > (size - sizeof(h)) / kLayerMeta + 1) {
+      return std::nullopt;
+    }
+    size_t meta = sizeof(h) + h.layers * sizeof(uint64_t) +
+                  (h.layers - 1) * sizeof(uint32_t);
+    if (meta > size) {
+      return std::nullopt;
+    }
+
+    CheckpointLayout layout;
+    const std::byte* p = base + sizeof(h);
+    for (size_t l = 0; l < h.layers; ++l, p += sizeof(uint64_t)) {
+      uint64_t n;
+      std::memcpy(&n, p, sizeof(n));
+      // with any weights, every width shows up in a blob of the file
+      if (h.layers > 1 && n > size / sizeof(float)) {
+        return std::nullopt;
+      }
+      layout.arch.push_back(static_cast<size_t>(n));
+    }
+    for (size_t l = 0; l + 1 < h.layers; ++l, p += sizeof(uint32_t)) {
+      uint32_t a;
+      std::memcpy(&a, p, sizeof(a));
+      if (a > static_cast<uint32_t>(Activation::Softmax)) {
+        return std::nullopt;
+      }
+      layout.acts.push_back(static_cast<Activation>(a));
+    }
+    if (!layout.compute_offsets() || layout.file_size != size ||
+        layout.align(meta) != h.data_offset) {
+      return std::nullopt;
+    }
+    return layout;
+  }
+};
+
+inline bool save_checkpoint(const NeuralNetwork& nn,
+                            const std::filesystem::path& path) {
+  CheckpointLayout layout;
+  layout.arch = nn.arch;
+  layout.acts = nn.acts;
+  if (!layout.compute_offsets()) {
+    return false;
+  }
+
+  std::vector<std::byte> buf(layout.file_size);
+  CheckpointHeader h;
+  std::memcpy(h.magic, kCheckpointMagic, sizeof(h.magic));
+  h.version = kCheckpointVersion;
+  h.dtype = 0;
+  h.layers = static_cast<uint32_t>(nn.arch.size());
+  h.alignment = kCheckpointAlignment;
+  h.data_offset = nn.ws.empty() ? layout.file_size : layout.ws_offsets[0];
+  h.file_size = layout.file_size;
+  std::memcpy(buf.data(), &h, sizeof(h));
+
+  std::byte* p = buf.data() + sizeof(h);
+  for (size_t n : nn.arch) {
+    uint64_t v = n;
+    std::memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+  }
+  for (Activation a : nn.acts) {
+    uint32_t v = static_cast<uint32_t>(a);
+    std::memcpy(p, &v, sizeof(v));
+    p += sizeof(v);
+  }
+  for (size_t l = 0; l < nn.ws.size(); ++l) {
+    std::memcpy(buf.data() + layout.ws_offsets[l], nn.ws[l].data.data(),
+                nn.ws[l].data.size() * sizeof(float));
+    std::memcpy(buf.data() + layout.bs_offsets[l], nn.bs[l].data.data(),
+                nn.bs[l].data.size() * sizeof(float));
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(buf.data()),
+            static_cast<std::streamsize>(buf.size()));
+  return static_cast<bool>(out);
+}
+
+// reads a checkpoint into a trainable network; nullopt if the file is
+// missing or not a valid checkpoint
+inline std::optional<NeuralNetwork> load_checkpoint(
+    const std::filesystem::path& path) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) {
+    return std::nullopt;
+  }
+  std::vector<std::byte> buf(static_cast<size_t>(in.tellg()));
+  in.seekg(0);
+  in.read(reinterpret_cast<char*>(buf.data()),
+          static_cast<std::streamsize>(buf.size()));
+  if (!in) {
+    return std::nullopt;
+  }
+
+  auto layout = CheckpointLayout::parse(buf.data(), buf.size());
+  if (!layout) {
+    return std::nullopt;
+  }
+  NeuralNetwork nn(layout->arch, layout->acts);
+  for (size_t l = 0; l < nn.ws.size(); ++l) {
+    std::memcpy(nn.ws[l].data.data(), buf.data() + layout->ws_offsets[l],
+                nn.ws[l].data.size() * sizeof(float));
+    std::memcpy(nn.bs[l].data.data(), buf.data() + layout->bs_offsets[l],
+                nn.bs[l].data.size() * sizeof(float));
+  }
+  return nn;
+}
+
+// Read-only model backed by a shared mmap of a checkpoint (MappedFile).
+// Weights are used straight from the mapped pages: opening costs one
+// page-table setup, and every process mapping the same file shares one
+// page-cache copy.
+class MappedModel {
+ public:
+  std::vector<size_t> arch;
+  std::vector<Activation> acts;
+  std::vector<MatrixView> ws;  // views into the mapping
+  std::vector<MatrixView> bs;
+
+  static std::optional<MappedModel> open(const std::filesystem::path& path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+      return std::nullopt;
+    }
+    MappedModel m(std::move(*file));
+    const std::byte* base = m.file.data();
+    auto layout = CheckpointLayout::parse(base, m.file.size());
+    if (!layout) {
+      return std::nullopt;
+    }
+    m.arch = layout->arch;
+    m.acts = layout->acts;
+    for (size_t l = 0; l + 1 < m.arch.size(); ++l) {
+      const float* w =
+          reinterpret_cast<const float*>(base + layout->ws_offsets[l]);
+      const float* b =
+          reinterpret_cast<const float*>(base + layout->bs_offsets[l]);
+      m.ws.push_back({w, m.arch[l], m.arch[l + 1], m.arch[l + 1]});
+      m.bs.push_back({b, 1, m.arch[l + 1], m.arch[l + 1]});
+    }
+    return m;
+  }
+
+  MappedModel(MappedModel&&) = default;
+  MappedModel& operator=(MappedModel&&) = default;
+
+  // output = network(input) for every row of input
+  void predict(MatrixView input, Matrix& output) const {
+    assert(input.cols == arch.front());
+    assert(input.data != output.data.data());
+    if (ws.empty()) {
+      output.resize(input.rows, input.cols);
+      for (size_t i = 0; i < input.rows; ++i) {
+        std::copy(input.row(i), input.row(i) + input.cols,
+                  &output.data[i * input.cols]);
+      }
+      return;
+    }
+    thread_local Matrix ping, pong;
+    MatrixView in = input;
+    for (size_t l = 0; l < ws.size(); ++l) {
+      Matrix& out = l + 1 == ws.size() ? output : (l % 2 ? pong : ping);
+      Matrix::layer_into(out, in, ws[l], bs[l], acts[l]);
+      in = out;
+    }
+  }
+
+ private:
+  explicit MappedModel(MappedFile f) : file(std::move(f)) {}
+
+  MappedFile file;  // ws / bs point into it
+};
+
+// Frozen copy of a trained network for low-latency serving, one or a few
+// rows per call.
+//
+// Each layer's weights are repacked into panels of kPanel columns stored
+// k-major ([np / kPanel][k][kPanel]), so a row's GEMV streams one
+// contiguous block per panel while the panel's kPanel outputs stay in
+// registers for the whole k loop, starting from the bias. The model is
+// immutable after construction and predict() is const: any number of
+// threads may call it at once. Each thread has its own scratch, sized on
+// its first call and reused after that, so later calls do not allocate.
+// Every call runs on the calling thread; for big batches use infer or
+// MappedModel, whose GEMM reuses each weight across many more rows.
+class InferenceModel {
+ public:
+  // columns per panel: kPanelVecs registers per row
+  static constexpr size_t kPanelVecs = 4;
+  static constexpr size_t kPanel = kPanelVecs * gemm::kVecWidth;
+  // accumulator vectors live at once (plus kPanelVecs of weights, this
+  // fills the register file) and rows per sweep over the weights
+  static constexpr size_t kChains = gemm::kVecWidth == 16 ? 16 : 8;
+  static constexpr size_t kRows = kChains / kPanelVecs;
+
+  std::vector<size_t> arch;
+  std::vector<Activation> acts;
+
+  explicit InferenceModel(const NeuralNetwork& net)
+      : arch(net.arch), acts(net.acts) {
+    for (size_t l = 0; l + 1 < arch.size(); ++l) {
+      Layer& L = layers.emplace_back();
+      L.k = arch[l];
+      L.n = arch[l + 1];
+      L.np = gemm::round_up(L.n, kPanel);
+      L.w.assign(L.k * L.np, 0.0f);
+      L.b.assign(L.np, 0.0f);
+      for (size_t j = 0; j < L.n; ++j) {
+        float* panel = &L.w[j / kPanel * L.k * kPanel + j % kPanel];
+        for (size_t k = 0; k < L.k; ++k) {
+          panel[k * kPanel] = net.ws[l](k, j);
+        }
+        L.b[j] = net.bs[l](0, j);
+      }
+      width = std::max(width, L.np);
+    }
+  }
+
+  // y (arch.back() floats) = network(x (arch.front() floats))
+  void predict(const float* x, float* y) const {
+    if (layers.empty()) {
+      std::copy(x, x + arch.front(), y);
+      return;
+    }
+    run_rows<1>(x, arch.front(), y, arch.back());
+  }
+
+  // output = network(input) for every row of input
+  void predict(MatrixView input, Matrix& output) const {
+    assert(input.cols == arch.front());
+    assert(input.data != output.data.data());
+    output.resize(input.rows, arch.back());
+    size_t i = 0;
+    for (; i + kRows <= input.rows; i += kRows) {
+      run_rows<kRows>(input.row(i), input.stride, &output.data[i * output.cols],
+                      output.cols);
+    }
+    for (; i < input.rows; ++i) {
+      predict(input.row(i), &output.data[i * output.cols]);
+    }
+  }
+
+  // bytes of packed weights and biases, padding included
+  size_t bytes() const {
+    size_t bytes = 0;
+    for (const Layer& L : layers) {
+      bytes += (L.w.size() + L.b.size()) * sizeof(float);
+    }
+    return bytes;
+  }
+
+ private:
+  struct Layer {
+    size_t k = 0, n = 0, np = 0;  // np: n rounded up to kPanel
+    std::vector<float> w;         // [np / kPanel][k][kPanel], zero padded
+    std::vector<float> b;         // np, zero padded
+  };
+
+  // y (R rows, stride ldy) = x . W + b for R rows of x (stride ldx).
+  // Each accumulator is one dependent add chain over k, so with fewer
+  // rows k is split over S interleaved chains per output instead, summed
+  // at the end, to keep kChains vectors in flight either way. Every loop
+  // touching acc is unrolled so that it lives in registers.
+  template <size_t R>
+  static void gemv(const Layer& L, const float* x, size_t ldx, float* y,
+                   size_t ldy) {
+    using gemm::load;
+    using gemm::store;
+    using gemm::vfloat;
+    constexpr size_t W = gemm::kVecWidth;
+    constexpr size_t V = kPanelVecs;
+    constexpr size_t S = std::max<size_t>(1, kChains / (R * V));
+    for (size_t j = 0; j < L.np; j += kPanel) {
+      const float* panel = &L.w[j * L.k];
+      vfloat acc[S][R][V] = {};
+      NN_UNROLL
+      for (size_t v = 0; v < V; ++v) {
+        vfloat b = load(&L.b[j + v * W]);
+        NN_UNROLL
+        for (size_t r = 0; r < R; ++r) {
+          acc[0][r][v] = b;
+        }
+      }
+      size_t p = 0;
+      for (; p + S <= L.k; p += S) {
+        NN_UNROLL
+        for (size_t s = 0; s < S; ++s) {
+          vfloat w[V];
+          NN_UNROLL
+          for (size_t v = 0; v < V; ++v) {
+            w[v] = load(panel + (p + s) * kPanel + v * W);
+          }
+          NN_UNROLL
+          for (size_t r = 0; r < R; ++r) {
+            float xv = x[r * ldx + p + s];
+            NN_UNROLL
+            for (size_t v = 0; v < V; ++v) {
+              acc[s][r][v] += w[v] * xv;
+            }
+          }
+        }
+      }
+      for (; p < L.k; ++p) {
+        NN_UNROLL
+        for (size_t r = 0; r < R; ++r) {
+          float xv = x[r * ldx + p];
+          NN_UNROLL
+          for (size_t v = 0; v < V; ++v) {
+            acc[0][r][v] += load(panel + p * kPanel + v * W) * xv;
+          }
+        }
+      }
+      NN_UNROLL
+      for (size_t r = 0; r < R; ++r) {
+        NN_UNROLL
+        for (size_t v = 0; v < V; ++v) {
+          vfloat sum = acc[0][r][v];
+          NN_UNROLL
+          for (size_t s = 1; s < S; ++s) {
+            sum += acc[s][r][v];
+          }
+          store(y + r * ldy + j + v * W, sum);
+        }
+      }
+    }
+  }
+
+  // R rows through every layer, ping-ponging between this thread's two
+  // scratch blocks (R x width each); the last layer's real columns are
+  // copied to out
+  template <size_t R>
+  void run_rows(const float* x, size_t ldx, float* out, size_t ldo) const {
+    thread_local std::vector<float> scratch;
+    if (scratch.size() < 2 * kRows * width) {
+      scratch.resize(2 * kRows * width);
+    }
+    float* buf[2] = {scratch.data(), scratch.data() + kRows * width};
+    const float* in = x;
+    size_t ld = ldx;
+    for (size_t l = 0; l < layers.size(); ++l) {
+      const Layer& L = layers[l];
+      float* y = buf[l % 2];
+      gemv<R>(L, in, ld, y, L.np);
+      with_activation(acts[l], [&](auto a) {
+        for (size_t r = 0; r < R; ++r) {
+          activate<decltype(a)>(y + r * L.np, 1, L.n);
+        }
+      });
+      in = y;
+      ld = L.np;
+    }
+    for (size_t r = 0; r < R; ++r) {
+      std::copy(in + r * ld, in + r * ld + arch.back(), out + r * ldo);
+    }
+  }
+
+  std::vector<Layer> layers;
+  size_t width = 0;  // widest np
+};
+
+// int8 GEMM used by QuantizedModel
+//
+// C (int32, m x np) = A (uint8, m x kp) . B (int8, kp x np), exact in
+// int32. B is packed as [kp / 4][np][4]: the 4 consecutive k of one column
+// are adjacent, which is what VPDPBUSD multiplies and sums in one lane, and
+// a run of columns at one k group is contiguous. kp is a multiple of 4 and
+// np of kTile; the padding is zero weights. All three paths (AVX512-VNNI,
+// AVX2, scalar) give the same int32 results.
+namespace qgemm {
+
+constexpr size_t kTile = 64;  // columns per kernel step (4 zmm of int32)
+
+inline size_t pack_index(size_t k, size_t j, size_t np) {
+  return ((k / 4) * np + j) * 4 + k % 4;
+}
+
+// reference path; also covers any CPU without AVX2
+inline void run_generic(size_t m, size_t n, size_t kp, size_t np,
+                        const uint8_t* a, size_t lda, const int8_t* b,
+                        int32_t* c) {
+  for (size_t i = 0; i < m; ++i) {
+    int32_t* crow = c + i * np;
+    std::fill(crow, crow + np, 0);
+    const uint8_t* arow = a + i * lda;
+    for (size_t g = 0; g < kp / 4; ++g) {
+      int32_t a0 = arow[4 * g], a1 = arow[4 * g + 1];
+      int32_t a2 = arow[4 * g + 2], a3 = arow[4 * g + 3];
+      const int8_t* bg = b + g * np * 4;
+      for (size_t j = 0; j < n; ++j) {
+        crow[j] += a0 * bg[4 * j] + a1 * bg[4 * j + 1] + a2 * bg[4 * j + 2] +
+                   a3 * bg[4 * j + 3];
+      }
     }
-    return *this;
   }
+}
 
-  static Matrix dot(const Matrix& a, const Matrix& b) {
-    assert(a.cols == b.rows);
-    Matrix dst(a.rows, b.cols, 0.0f);
-    for (size_t i = 0; i < dst.rows; ++i) {
-      for (size_t j = 0; j < dst.cols; ++j) {
-        for (size_t k = 0; k < a.cols; ++k) {
-          dst(i, j) += a(i, k) * b(k, j);
-        }
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+inline bool cpu_has_vnni() {
+  static bool has = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512vnni") != 0;
+  }();
+  return has;
+}
+
+// R rows x kTile columns, VPDPBUSD: 4 u8 x s8 products summed into each
+// int32 lane, no intermediate saturation
+template <size_t R>
+__attribute__((target("avx512f,avx512vnni"))) inline void vnni_tile(
+    size_t groups, const uint8_t* a, size_t lda, const int8_t* b, size_t np,
+    int32_t* c) {
+  __m512i acc[R][4];
+  for (size_t r = 0; r < R; ++r) {
+    for (size_t v = 0; v < 4; ++v) {
+      acc[r][v] = _mm512_setzero_si512();
+    }
+  }
+  for (size_t g = 0; g < groups; ++g) {
+    const int8_t* bg = b + g * np * 4;
+    __m512i bv[4];
+    for (size_t v = 0; v < 4; ++v) {
+      bv[v] = _mm512_loadu_si512(bg + v * 64);
+    }
+    for (size_t r = 0; r < R; ++r) {
+      int32_t a4;
+      std::memcpy(&a4, a + r * lda + 4 * g, sizeof(a4));
+      __m512i av = _mm512_set1_epi32(a4);
+      for (size_t v = 0; v < 4; ++v) {
+        acc[r][v] = _mm512_dpbusd_epi32(acc[r][v], av, bv[v]);
       }
     }
-    return dst;
   }
-  // TODO: Multi-threaded Dot Product
-  //  A faster version of dot() that uses std::thread
+  for (size_t r = 0; r < R; ++r) {
+    for (size_t v = 0; v < 4; ++v) {
+      _mm512_storeu_si512(c + r * np + v * 16, acc[r][v]);
+    }
+  }
+}
 
-  // row index , start col idx and how many next cols u want is that nums_cols
-  Matrix slice_row(size_t row_idx, size_t start_col, size_t num_cols) const {
-    assert(row_idx < rows);
-    assert(start_col + num_cols <= cols);
-    Matrix m(1, num_cols);
-    for (size_t k = 0; k < num_cols; k++) {
-      m(0, k) = (*this)(row_idx, start_col + k);
+__attribute__((target("avx512f,avx512vnni"))) inline void run_vnni(
+    size_t m, size_t kp, size_t np, const uint8_t* a, size_t lda,
+    const int8_t* b, int32_t* c) {
+  for (size_t j = 0; j < np; j += kTile) {
+    size_t i = 0;
+    for (; i + 4 <= m; i += 4) {
+      vnni_tile<4>(kp / 4, a + i * lda, lda, b + j * 4, np, c + i * np + j);
+    }
+    for (; i < m; ++i) {
+      vnni_tile<1>(kp / 4, a + i * lda, lda, b + j * 4, np, c + i * np + j);
     }
-    return m;
   }
+}
 
-  Matrix& transpose() {
-    assert(rows * cols == data.size());
-    std::vector<float> temp(data.size());
-    for (size_t i = 0; i < rows; i++) {
-      for (size_t j = 0; j < cols; j++) {
-        temp[j * rows + i] = data[i * cols + j];
+// AVX2 has no u8 x s8 dot product that cannot saturate (VPMADDUBSW clamps
+// pair sums at 32767, and 255 * 127 * 2 is past that), so both sides are
+// widened to int16 and multiplied with VPMADDWD. Each accumulator holds two
+// partial sums per column, folded together at the end.
+__attribute__((target("avx2"))) inline void run_avx2(size_t m, size_t kp,
+                                                    size_t np,
+                                                    const uint8_t* a,
+                                                    size_t lda,
+                                                    const int8_t* b,
+                                                    int32_t* c) {
+  for (size_t i = 0; i < m; ++i) {
+    const uint8_t* arow = a + i * lda;
+    for (size_t j = 0; j < np; j += 32) {
+      __m256i lo[4], hi[4];
+      for (size_t v = 0; v < 4; ++v) {
+        lo[v] = _mm256_setzero_si256();
+        hi[v] = _mm256_setzero_si256();
+      }
+      for (size_t g = 0; g < kp / 4; ++g) {
+        const uint8_t* a4 = arow + 4 * g;
+        // a0 a1 a2 a3 as int16, repeated for four columns
+        __m256i av = _mm256_set1_epi64x(
+            int64_t(a4[0]) | int64_t(a4[1]) << 16 | int64_t(a4[2]) << 32 |
+            int64_t(a4[3]) << 48);
+        const int8_t* bg = b + (g * np + j) * 4;
+        for (size_t v = 0; v < 4; ++v) {
+          __m256i bv =
+              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bg + 32 * v));
+          __m256i b0 = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(bv));
+          __m256i b1 = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(bv, 1));
+          lo[v] = _mm256_add_epi32(lo[v], _mm256_madd_epi16(b0, av));
+          hi[v] = _mm256_add_epi32(hi[v], _mm256_madd_epi16(b1, av));
+        }
+      }
+      for (size_t v = 0; v < 4; ++v) {
+        // [c0 c1 c4 c5 | c2 c3 c6 c7] -> c0..c7
+        __m256i s = _mm256_hadd_epi32(lo[v], hi[v]);
+        s = _mm256_permute4x64_epi64(s, 0xd8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + i * np + j + 8 * v),
+                            s);
       }
     }
-    data = std::move(temp);
-    std::swap(rows, cols);
+  }
+}
+#endif
 
-    return *this;
+// C = A . B on the best path the CPU has; n is the number of real columns
+// (the generic path skips the padding)
+inline void run(size_t m, size_t n, size_t kp, size_t np, const uint8_t* a,
+                size_t lda, const int8_t* b, int32_t* c) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  simd::Level l = simd::level();
+  if (l == simd::Level::AVX512 && cpu_has_vnni()) {
+    return run_vnni(m, kp, np, a, lda, b, c);
   }
+  if (l >= simd::Level::AVX2) {
+    return run_avx2(m, kp, np, a, lda, b, c);
+  }
+#endif
+  run_generic(m, n, kp, np, a, lda, b, c);
+}
 
-  // TODO: Matrix Inverse
-  Matrix inverse() const {
-    if (rows != cols || rows == 0) {
-      return Matrix();
-    }
+}  // namespace qgemm
+
+// Post-training int8 quantization for inference.
+//
+// Weights are quantized symmetrically per output channel (column j of ws[l]
+// gets its own scale, max |w| / 127). Each layer's input is quantized per
+// tensor to uint8 with a scale and zero point taken from the range seen on
+// a calibration batch, so
+//   x . w  ~=  sx * sw[j] * (sum_k xq[k] * wq[k][j] - zx * sum_k wq[k][j])
+// The int8 GEMM accumulates exactly in int32; the epilogue turns each row
+// back into floats with one multiply-add per element (the zero point term
+// and the bias folded into a per-column offset), applies the activation
+// and, for hidden layers, requantizes straight into the next layer's
+// input. Inputs outside the calibrated range are clamped to it.
+class QuantizedModel {
+ public:
+  struct Layer {
+    size_t k = 0, n = 0;    // real shape of ws[l]
+    size_t kp = 0, np = 0;  // padded, see qgemm
+    std::vector<int8_t> w;  // packed weights
+    std::vector<float> scale;   // sx * sw[j]
+    std::vector<float> offset;  // bias[j] - scale[j] * zx * sum_k wq[k][j]
+    float in_scale = 1.0f;      // sx
+    int32_t in_zero = 0;        // zx
+  };
 
-    const size_t n = rows;
-    const float EPS = 1e-8f;
+  std::vector<size_t> arch;
+  std::vector<Activation> acts;
+  std::vector<Layer> layers;
 
-    // Augmented matrix [A | I]
-    Matrix aug(n, 2 * n, 0.0f);
+  // quantizes net's weights and picks every layer's input range from a
+  // forward pass over `sample` (a few hundred representative rows of
+  // inputs; extra target columns are ignored)
+  static QuantizedModel calibrate(const NeuralNetwork& net,
+                                  MatrixView sample) {
+    assert(sample.rows > 0 && sample.cols >= net.arch.front());
+    QuantizedModel q;
+    q.arch = net.arch;
+    q.acts = net.acts;
 
-    for (size_t i = 0; i < n; ++i) {
-      for (size_t j = 0; j < n; ++j) {
-        aug(i, j) = (*this)(i, j);
+    // min / max of the input and of every layer's output
+    std::vector<float> lo(net.arch.size(), 0.0f), hi(net.arch.size(), 0.0f);
+    Workspace work;
+    work.prepare(net.arch);
+    for (size_t begin = 0; begin < sample.rows;
+         begin += NeuralNetwork::kCostBatch) {
+      size_t rows = std::min(NeuralNetwork::kCostBatch, sample.rows - begin);
+      MatrixView in = sample.block(begin, 0, rows, net.arch.front());
+      net.infer_into(in, work.as);
+      for (size_t l = 0; l < net.arch.size(); ++l) {
+        MatrixView a = l == 0 ? in : work.as[l].view();
+        for (size_t i = 0; i < a.rows; ++i) {
+          for (size_t j = 0; j < a.cols; ++j) {
+            lo[l] = std::min(lo[l], a(i, j));
+            hi[l] = std::max(hi[l], a(i, j));
+          }
+        }
       }
-      aug(i, n + i) = 1.0f;
     }
 
-    for (size_t p = 0; p < n; ++p) {
-      size_t max_row = p;
-      for (size_t i = p + 1; i < n; ++i) {
-        if (std::abs(aug(i, p)) > std::abs(aug(max_row, p))) {
-          max_row = i;
+    for (size_t l = 0; l + 1 < net.arch.size(); ++l) {
+      Layer& L = q.layers.emplace_back();
+      L.k = net.arch[l];
+      L.n = net.arch[l + 1];
+      L.kp = gemm::round_up(L.k, 4);
+      L.np = gemm::round_up(L.n, qgemm::kTile);
+      // the range always contains 0, so zero maps to an exact code
+      L.in_scale = hi[l] > lo[l] ? (hi[l] - lo[l]) / 255.0f : 1.0f;
+      L.in_zero = int32_t(std::lround(-lo[l] / L.in_scale));
+      L.w.assign(L.kp * L.np, 0);
+      L.scale.resize(L.n);
+      L.offset.resize(L.n);
+      const Matrix& w = net.ws[l];
+      for (size_t j = 0; j < L.n; ++j) {
+        float max_abs = 0.0f;
+        for (size_t k = 0; k < L.k; ++k) {
+          max_abs = std::max(max_abs, std::abs(w(k, j)));
         }
-      }
-
-      if (max_row != p) {
-        for (size_t j = 0; j < 2 * n; ++j) {
-          std::swap(aug(p, j), aug(max_row, j));
+        float sw = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+        int32_t sum = 0;
+        for (size_t k = 0; k < L.k; ++k) {
+          long v = std::lround(w(k, j) / sw);
+          int8_t wq = int8_t(std::clamp(v, -127l, 127l));
+          L.w[qgemm::pack_index(k, j, L.np)] = wq;
+          sum += wq;
         }
+        L.scale[j] = L.in_scale * sw;
+        L.offset[j] = net.bs[l](0, j) - L.scale[j] * float(L.in_zero * sum);
       }
+    }
+    return q;
+  }
 
-      if (std::abs(aug(p, p)) < EPS) {
-        return Matrix();  // not invertible
+  // output = network(input) for every row of input. Thread safe: the
+  // scratch buffers are per thread; big batches are split over the pool.
+  void predict(MatrixView input, Matrix& output) const {
+    assert(input.cols == arch.front());
+    assert(input.data != output.data.data());
+    output.resize(input.rows, arch.back());
+    if (layers.empty()) {
+      for (size_t i = 0; i < input.rows; ++i) {
+        std::copy(input.row(i), input.row(i) + input.cols,
+                  &output.data[i * input.cols]);
       }
-
-      float pivot = aug(p, p);
-      for (size_t j = 0; j < 2 * n; ++j) {
-        aug(p, j) /= pivot;
+      return;
+    }
+    size_t blocks = (input.rows + kRowBlock - 1) / kRowBlock;
+    size_t work = input.rows * layers.front().kp * layers.front().np;
+    auto run = [&](size_t b) {
+      size_t begin = b * kRowBlock;
+      predict_block(input.row_range(begin,
+                                    std::min(kRowBlock, input.rows - begin)),
+                    &output.data[begin * output.cols]);
+    };
+    if (blocks > 1 && work >= gemm::kParallelMinWork) {
+      thread_pool().parallel_for(blocks, run);
+    } else {
+      for (size_t b = 0; b < blocks; ++b) {
+        run(b);
       }
+    }
+  }
 
-      for (size_t i = 0; i < n; ++i) {
-        if (i != p) {
-          float factor = aug(i, p);
-          for (size_t j = 0; j < 2 * n; ++j) {
-            aug(i, j) -= factor * aug(p, j);
-          }
-        }
-      }
+  // bytes of packed weights, for comparing with 4 * parameters
+  size_t weight_bytes() const {
+    size_t bytes = 0;
+    for (const Layer& L : layers) {
+      bytes += L.w.size();
     }
+    return bytes;
+  }
 
-    Matrix inv(n, n, 0.0f);
-    for (size_t i = 0; i < n; ++i) {
-      for (size_t j = 0; j < n; ++j) {
-        inv(i, j) = aug(i, n + j);
+ private:
+  static constexpr size_t kRowBlock = 64;
+
+  // input rows -> uint8 codes of layer L's input, padding columns = 0
+  static void quantize_rows(MatrixView x, const Layer& L, uint8_t* dst) {
+    float inv = 1.0f / L.in_scale;
+    float zero = float(L.in_zero) + 0.5f;
+    for (size_t i = 0; i < x.rows; ++i) {
+      const float* src = x.row(i);
+      uint8_t* row = dst + i * L.kp;
+      for (size_t k = 0; k < L.k; ++k) {
+        row[k] = quantize(src[k], inv, zero);
       }
+      std::fill(row + L.k, row + L.kp, uint8_t(0));
     }
+  }
 
-    return inv;
+  // round half up and clamp to [0, 255]
+  static uint8_t quantize(float x, float inv, float zero) {
+    float v = std::clamp(x * inv + zero, 0.0f, 255.0f);
+    return uint8_t(v);
   }
-  void print(const std::string& name, size_t padding = 0) const {
-    std::string pad(padding, ' ');
-    std::cout << pad << name << " = [\n";
-    for (size_t i = 0; i < rows; ++i) {
-      std::cout << pad << "    ";
-      for (size_t j = 0; j < cols; ++j) {
-        std::cout << (*this)(i, j) << " ";
+
+  void predict_block(MatrixView x, float* out) const {
+    thread_local std::vector<uint8_t> in, next;
+    thread_local std::vector<int32_t> acc;
+    thread_local std::vector<float> row;
+    size_t m = x.rows;
+    in.resize(m * layers.front().kp);
+    quantize_rows(x, layers.front(), in.data());
+    for (size_t l = 0; l < layers.size(); ++l) {
+      const Layer& L = layers[l];
+      const Layer* N = l + 1 < layers.size() ? &layers[l + 1] : nullptr;
+      acc.resize(m * L.np);
+      qgemm::run(m, L.n, L.kp, L.np, in.data(), L.kp, L.w.data(), acc.data());
+      if (N) {
+        next.resize(m * N->kp);
       }
-      std::cout << "\n";
+      row.resize(L.n);
+      with_activation(acts[l], [&](auto a) {
+        for (size_t i = 0; i < m; ++i) {
+          float* y = N ? row.data() : out + i * L.n;
+          const int32_t* c = &acc[i * L.np];
+          for (size_t j = 0; j < L.n; ++j) {
+            y[j] = L.scale[j] * float(c[j]) + L.offset[j];
+          }
+          activate<decltype(a)>(y, 1, L.n);
+          if (N) {
+            float inv = 1.0f / N->in_scale;
+            float zero = float(N->in_zero) + 0.5f;
+            uint8_t* q = &next[i * N->kp];
+            for (size_t j = 0; j < L.n; ++j) {
+              q[j] = quantize(y[j], inv, zero);
+            }
+            std::fill(q + L.n, q + N->kp, uint8_t(0));
+          }
+        }
+      });
+      std::swap(in, next);
     }
-    std::cout << pad << "]\n";
   }
 };
 
-class NeuralNetwork {
+// Streaming training data
+//
+// A DataSource hands out the rows of a training set ([inputs | targets],
+// like t) a few at a time, so the set never has to fit in memory.
+// Prefetcher wraps one with a background thread that reads the next
+// minibatch while the current one trains.
+class DataSource {
  public:
-  std::vector<size_t>
-      arch;                // Architecture it stores number of neuros per layer
-  std::vector<Matrix> ws;  // Weights
-  std::vector<Matrix> bs;  // Biases
-  std::vector<Matrix> as;  // Activations
-  std::vector<Matrix> zs;  // Pre-activations (before activation function)
+  virtual ~DataSource() = default;
 
-  NeuralNetwork(const std::vector<size_t>& architecture) : arch(architecture) {
-    assert(arch.size() > 0);
+  // inputs + targets
+  virtual size_t cols() const = 0;
 
-    as.emplace_back(1, arch[0]);  // input layer for example if arch is {2 , 3 ,
-                                  // 1} then input matix should be 1x2
-    for (size_t i = 1; i < arch.size(); ++i) {
-      ws.emplace_back(arch[i - 1], arch[i]);
-      bs.emplace_back(1, arch[i]);
-      as.emplace_back(1, arch[i]);
-      zs.emplace_back(1, arch[i]);
+  // copies up to max_rows of the next rows into out (resized to n x cols)
+  // and returns n; 0 once the data is exhausted or failed()
+  virtual size_t read(Matrix& out, size_t max_rows) = 0;
+
+  // back to the first row; clears failed()
+  virtual void rewind() = 0;
+
+  // reading stopped at bad data rather than at the end; check it when
+  // read() returns 0
+  virtual bool failed() const { return false; }
+};
+
+// Row file layout, version 1: RowFileHeader, then rows x cols little-endian
+// float32s, row-major, from data_offset (64-byte aligned).
+struct RowFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype;  // 0 = float32
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t data_offset;
+};
+
+constexpr char kRowFileMagic[8] = {'t', 'i', 'n', 'y', 'r', 'o', 'w', 's'};
+constexpr uint32_t kRowFileVersion = 1;
+constexpr uint64_t kRowFileDataOffset = 64;
+
+// Writes a row file a block at a time, so it can be bigger than memory.
+// The row count in the header is filled in by finish().
+class RowFileWriter {
+ public:
+  static std::optional<RowFileWriter> create(const std::filesystem::path& path,
+                                             size_t cols) {
+    RowFileWriter w;
+    w.out.open(path, std::ios::binary | std::ios::trunc);
+    if (!w.out) {
+      return std::nullopt;
     }
+    w.cols = cols;
+    w.write_header();
+    return w;
   }
 
-  Matrix& get_input() { return as.front(); }
-  Matrix& get_output() { return as.back(); }
+  bool append(MatrixView rows) {
+    assert(rows.cols == cols);
+    for (size_t i = 0; i < rows.rows; ++i) {
+      out.write(reinterpret_cast<const char*>(rows.row(i)),
+                static_cast<std::streamsize>(cols * sizeof(float)));
+    }
+    count += rows.rows;
+    return static_cast<bool>(out);
+  }
 
-  const Matrix& get_output() const { return as.back(); }
-  void zero() {
-    for (auto& a : as) {
-      a.fill(0.0f);
+  // patches the header and closes the file; false on any I/O error
+  bool finish() {
+    write_header();
+    out.close();
+    return !out.fail();
+  }
+
+ private:
+  RowFileWriter() = default;
+
+  std::ofstream out;
+  size_t cols = 0;
+  size_t count = 0;
+
+  void write_header() {
+    RowFileHeader h;
+    std::memcpy(h.magic, kRowFileMagic, sizeof(h.magic));
+    h.version = kRowFileVersion;
+    h.dtype = 0;
+    h.rows = count;
+    h.cols = cols;
+    h.data_offset = kRowFileDataOffset;
+    char pad[kRowFileDataOffset] = {};
+    std::memcpy(pad, &h, sizeof(h));
+    out.seekp(0);
+    out.write(pad, sizeof(pad));
+    out.seekp(0, std::ios::end);
+  }
+};
+
+inline bool save_rows(MatrixView t, const std::filesystem::path& path) {
+  auto w = RowFileWriter::create(path, t.cols);
+  return w && w->append(t) && w->finish();
+}
+
+// Rows of a row file, read out of a MappedFile: pages are only faulted in
+// as read() reaches them, and the kernel can drop them again afterwards.
+class RowFileSource : public DataSource {
+ public:
+  static std::optional<RowFileSource> open(const std::filesystem::path& path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+      return std::nullopt;
     }
-    for (auto& w : ws) {
-      w.fill(0.0f);
+    RowFileHeader h;
+    if (file->size() < sizeof(h)) {
+      return std::nullopt;
     }
-    for (auto& b : bs) {
-      b.fill(0.0f);
+    std::memcpy(&h, file->data(), sizeof(h));
+    if (std::memcmp(h.magic, kRowFileMagic, sizeof(h.magic)) != 0 ||
+        h.version != kRowFileVersion || h.dtype != 0 ||
+        h.data_offset != kRowFileDataOffset || h.cols == 0 ||
+        file->size() < h.data_offset) {
+      return std::nullopt;
     }
-    for (auto& z : zs) {
-      z.fill(0.0f);
+    // divide rather than multiply, so a crafted header cannot wrap
+    size_t floats = (file->size() - h.data_offset) / sizeof(float);
+    if (h.cols > floats || h.rows > floats / h.cols ||
+        file->size() != h.data_offset + h.rows * h.cols * sizeof(float)) {
+      return std::nullopt;
     }
+    return RowFileSource(std::move(*file), h.rows, h.cols);
   }
 
-  void randomize(float low, float high) {
-    for (auto& a : as) {
-      a.randomize(low, high);
-    }
-    for (auto& w : ws) {
-      w.randomize(low, high);
+  size_t rows() const { return total; }
+  size_t cols() const override { return width; }
+
+  size_t read(Matrix& out, size_t max_rows) override {
+    size_t n = std::min(max_rows, total - next);
+    out.resize(n, width);
+    std::memcpy(out.data.data(), first + next * width,
+                n * width * sizeof(float));
+    next += n;
+    return n;
+  }
+
+  void rewind() override { next = 0; }
+
+  // the whole file as one matrix, without copying
+  MatrixView view() const { return {first, total, width, width}; }
+
+ private:
+  RowFileSource(MappedFile f, size_t rows, size_t cols)
+      : file(std::move(f)),
+        first(reinterpret_cast<const float*>(file.data() + kRowFileDataOffset)),
+        total(rows),
+        width(cols) {}
+
+  MappedFile file;
+  const float* first;
+  size_t total;
+  size_t width;
+  size_t next = 0;
+};
+
+// Comma (or `sep`) separated rows of numbers, one sample per line, parsed
+// as they are read. Every line must have as many fields as the first one;
+// read() stops before the first one that does not and sets error_line().
+class CsvSource : public DataSource {
+ public:
+  static std::optional<CsvSource> open(const std::filesystem::path& path,
+                                       bool has_header = false,
+                                       char sep = ',') {
+    CsvSource src;
+    src.in.open(path);
+    if (!src.in) {
+      return std::nullopt;
     }
-    for (auto& b : bs) {
-      b.randomize(low, high);
+    src.header = has_header;
+    src.sep = sep;
+    src.rewind();
+    // the first data line fixes the width
+    std::streampos start = src.in.tellg();
+    if (!std::getline(src.in, src.line) || src.parse() == 0) {
+      return std::nullopt;
     }
+    src.width = src.fields.size();
+    src.in.seekg(start);
+    return src;
   }
-  void print(const std::string& name = "nn") const {
-    std::cout << name << " = [\n";
-    for (size_t i = 0; i < ws.size(); ++i) {
-      ws[i].print("ws" + std::to_string(i), 4);
-      bs[i].print("bs" + std::to_string(i), 4);
+
+  size_t cols() const override { return width; }
+
+  // returns the rows before a malformed line, then 0 until rewind()
+  size_t read(Matrix& out, size_t max_rows) override {
+    out.resize(error ? 0 : max_rows, width);
+    size_t n = 0;
+    while (!error && n < max_rows && std::getline(in, line)) {
+      ++line_no;
+      if (line.empty()) {
+        continue;
+      }
+      if (parse() != width) {
+        error = line_no;
+        break;
+      }
+      std::copy(fields.begin(), fields.end(), out.data.begin() + n * width);
+      ++n;
     }
-    std::cout << "]\n";
+    out.resize(n, width);
+    return n;
   }
 
-  void forward(Activation act = NN_ACT) {
-    for (size_t i = 0; i < ws.size(); i++) {
-      as[i + 1] =
-          Matrix::dot(as[i], ws[i]);  // matrix multiplicaton of weight and as
-      as[i + 1] += bs[i];
-      zs[i] = as[i + 1];  // save pre-activation values for backprop
-      as[i + 1].apply_activation(act);
+  void rewind() override {
+    in.clear();
+    in.seekg(0);
+    line_no = 0;
+    error = 0;
+    if (header) {
+      std::getline(in, line);
+      line_no = 1;
     }
   }
 
-  float cost(const Matrix& t) {
-    assert(get_input().cols + get_output().cols == t.cols);
-    float c = 0.0f;
-    size_t n = t.rows;
-    for (size_t i = 0; i < n; i++) {
-      // we need to get output the true value
-      Matrix inputs = t.slice_row(i, 0, get_input().cols);
-      Matrix true_vals = t.slice_row(i, get_input().cols, get_output().cols);
+  bool failed() const override { return error != 0; }
+
+  // 1-based line of the file read() stopped at, 0 if none
+  size_t error_line() const { return error; }
+
+ private:
+  CsvSource() = default;
 
-      get_input() = inputs;
-      forward();
+  std::ifstream in;
+  std::string line;
+  std::vector<float> fields;
+  bool header = false;
+  char sep = ',';
+  size_t width = 0;
+  size_t line_no = 0;  // lines consumed so far
+  size_t error = 0;
 
-      for (size_t j = 0; j < true_vals.cols; ++j) {
-        float d = get_output()(0, j) - true_vals(0, j);
-        c += d * d;
+  // splits line into fields; returns the count, 0 on a bad number
+  size_t parse() {
+    fields.clear();
+    const char* p = line.c_str();
+    for (;;) {
+      char* end;
+      float v = std::strtof(p, &end);
+      if (end == p) {
+        return 0;
       }
+      fields.push_back(v);
+      while (*end == ' ' || *end == '\t' || *end == '\r') {
+        ++end;
+      }
+      if (*end != sep) {
+        return *end == 0 ? fields.size() : 0;
+      }
+      p = end + 1;
     }
-    return c / n;
   }
+};
 
-  NeuralNetwork backprop(const Matrix& t) {
-    size_t n = t.rows;
-    assert(get_input().cols + get_output().cols == t.cols);
-
-    NeuralNetwork g(arch);
-    g.zero();
-
-    for (size_t i = 0; i < n; ++i) {
-      Matrix in = t.slice_row(i, 0, get_input().cols);
-
-      Matrix out = t.slice_row(i, get_input().cols, get_output().cols);
+// Double-buffered minibatches from a DataSource: while the caller trains on
+// one buffer, a background thread reads the next batch into the other, so
+// file I/O and parsing overlap compute. The source belongs to the
+// Prefetcher while it exists: do not read from it or wrap it twice.
+//   nn::Prefetcher batches(source, 256);
+//   for (nn::MatrixView b = batches.next(); b.rows; b = batches.next()) {
+//     net.backprop_into(b, grad);
+//     opt.step(net, grad);
+//   }
+class Prefetcher {
+ public:
+  Prefetcher(DataSource& source, size_t batch_rows)
+      : source(source), batch_rows(batch_rows) {
+    assert(batch_rows > 0);
+    start();
+  }
 
-      get_input() = in;
+  ~Prefetcher() { stop(); }
 
-      forward();
+  Prefetcher(const Prefetcher&) = delete;
+  Prefetcher& operator=(const Prefetcher&) = delete;
 
-      for (auto& a : g.as) {
-        a.fill(0.0f);
-      }
+  // the next minibatch, valid until the following next() / rewind(); an
+  // empty view (rows == 0) once the source is exhausted or failed()
+  MatrixView next() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (held >= 0) {
+      ready[held] = false;  // hand the previous buffer back
+      held = -1;
+      changed.notify_all();
+    }
+    int slot = consumed % 2;
+    changed.wait(lock, [&] { return ready[slot]; });
+    if (buf[slot].rows == 0) {
+      return {};
+    }
+    held = slot;
+    ++consumed;
+    return buf[slot];
+  }
 
-      for (size_t j = 0; j < out.cols; ++j) {
-#ifdef NN_BACKPROP_TRADITIONAL
-        g.get_output()(0, j) = 2.0f * (get_output()(0, j) - out(0, j));
-#else
-        g.get_output()(0, j) = get_output()(0, j) - out(0, j);
-#endif
-      }
+  // starts over from the first row of the source
+  void rewind() {
+    stop();
+    source.rewind();
+    start();
+  }
 
-#ifdef NN_BACKPROP_TRADITIONAL
-      float s = 1.0f;
-#else
-      float s = 2.0f;
-#endif
+  // the source stopped at bad data; only meaningful once next() has
+  // returned an empty view (the reader thread is done with it then)
+  bool failed() const { return source.failed(); }
 
-      for (size_t l = arch.size() - 1; l > 0; --l) {
-        for (size_t j = 0; j < as[l].cols; ++j) {
-          float a = as[l](0, j);
-          float da = g.as[l](0, j);
-          float z = zs[l - 1](0, j);  // pre-activation value
-          float qa = Dactf(a, z, NN_ACT);
+ private:
+  DataSource& source;
+  size_t batch_rows;
+  Matrix buf[2];
+  bool ready[2] = {false, false};
+  int held = -1;  // buffer the caller is using
+  size_t consumed = 0;
+  bool quit = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread reader;
 
-          g.bs[l - 1](0, j) += s * da * qa;
+  void start() {
+    ready[0] = ready[1] = false;
+    held = -1;
+    consumed = 0;
+    quit = false;
+    reader = std::thread([this] { read_loop(); });
+  }
 
-          for (size_t k = 0; k < as[l - 1].cols; ++k) {
-            float pa = as[l - 1](0, k);
-            float w = ws[l - 1](k, j);
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    changed.notify_all();
+    reader.join();
+  }
 
-            g.ws[l - 1](k, j) += s * da * qa * pa;
-            g.as[l - 1](0, k) += s * da * qa * w;
-          }
+  void read_loop() {
+    for (size_t produced = 0;; ++produced) {
+      int slot = produced % 2;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return quit || !ready[slot]; });
+        if (quit) {
+          return;
         }
       }
+      // the slot is ours until it is marked ready
+      size_t n = source.read(buf[slot], batch_rows);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready[slot] = true;
+      }
+      changed.notify_all();
+      if (n == 0) {
+        return;
+      }
     }
+  }
+};
 
-    for (size_t i = 0; i < g.ws.size(); ++i) {
-      for (size_t j = 0; j < g.ws[i].data.size(); ++j) {
-        g.ws[i].data[j] /= n;
-      }
-      for (size_t j = 0; j < g.bs[i].data.size(); ++j) {
-        g.bs[i].data[j] /= n;
+// Closed-form fit of the output layer (ridge regression)
+//
+// With the hidden layers fixed, the last layer is linear in its weights:
+// z = h . W + b, h the last hidden activation (the input for a one-layer
+// net). OutputLayerFit streams rows through the hidden layers, keeping the
+// means of h and y and their centered co-moments in double per shard of
+// the pool, then solves
+//   (cov(h) + l2 I) W = cov(h, y),   b = mean(y) - mean(h) . W
+// with a Cholesky factorization: the least-squares W and b, with an L2
+// penalty of l2 * |W|^2 on the mean squared error (not on b). Centering
+// keeps the bias out of the system, which conditions it much better than
+// solving for [W; b] directly. Each chunk is centered on its own mean
+// before its float GEMMs and folded in with the pairwise update of Chan et
+// al., as are the shards, so a large offset in h never has to cancel out
+// of float sums.
+//
+// The targets are what the layer's pre-activation should be: y itself for
+// Identity (exact), the inverse of the activation for Sigmoid / Tanh (with
+// y clamped just inside the range; least squares on z, a good start for
+// SGD rather than the MSE optimum). Other output activations cannot be
+// fitted this way.
+class OutputLayerFit {
+ public:
+  explicit OutputLayerFit(const NeuralNetwork& net)
+      : k(net.arch[net.arch.size() - 2]), o(net.arch.back()) {
+    size_t shards = get_num_threads();
+    for (size_t s = 0; s < shards; ++s) {
+      parts.emplace_back(k, o);
+    }
+  }
+
+  static bool can_fit(Activation act) {
+    return act == Activation::Identity || act == Activation::Sigmoid ||
+           act == Activation::Tanh;
+  }
+
+  // adds the rows of t ([inputs | targets]); rows are split over the pool
+  void add(const NeuralNetwork& net, MatrixView t) {
+    assert(t.cols == net.arch.front() + o);
+    size_t chunks =
+        (t.rows + NeuralNetwork::kCostBatch - 1) / NeuralNetwork::kCostBatch;
+    size_t used = std::min(parts.size(), chunks);
+    if (used == 0) {
+      return;
+    }
+    auto run = [&](size_t s) {
+      // whole chunks per shard, so every chunk is one full GEMM
+      size_t begin = chunks * s / used * NeuralNetwork::kCostBatch;
+      size_t end = std::min(
+          t.rows, chunks * (s + 1) / used * NeuralNetwork::kCostBatch);
+      for (size_t b = begin; b < end; b += NeuralNetwork::kCostBatch) {
+        size_t rows = std::min(NeuralNetwork::kCostBatch, end - b);
+        parts[s].add(net, t.row_range(b, rows));
       }
+    };
+    if (used == 1) {
+      run(0);
+    } else {
+      thread_pool().parallel_for(used, run);
     }
+  }
 
-    return g;
+  // rows added so far
+  size_t count() const {
+    size_t n = 0;
+    for (const Part& p : parts) {
+      n += p.n;
+    }
+    return n;
   }
-  void learn(const NeuralNetwork& g, float rate) {
-    for (size_t i = 0; i < ws.size(); ++i) {
-      for (size_t j = 0; j < ws[i].data.size(); ++j) {
-        ws[i].data[j] -= rate * g.ws[i].data[j];
+
+  // writes the fitted ws.back() / bs.back() into net; false if nothing was
+  // added, the output activation cannot be fitted, or the system is
+  // singular (only possible with l2 = 0)
+  bool solve(NeuralNetwork& net, float l2 = 1e-6f) const {
+    size_t n = count();
+    if (n == 0 || !can_fit(net.acts.back())) {
+      return false;
+    }
+    // shards merged in a fixed order
+    Part sum(k, o);
+    for (const Part& p : parts) {
+      sum.merge(p.n, p.h.data(), p.y.data(), p.hh.data(), p.hy.data());
+    }
+    const std::vector<double>& mh = sum.h;
+    const std::vector<double>& my = sum.y;
+    Matrix c(k, k), cy(k, o);
+    for (size_t i = 0; i < k; ++i) {
+      for (size_t j = 0; j < k; ++j) {
+        c(i, j) = float(sum.hh[i * k + j] / n);
       }
-      for (size_t j = 0; j < bs[i].data.size(); ++j) {
-        bs[i].data[j] -= rate * g.bs[i].data[j];
+      c(i, i) += l2;
+      for (size_t j = 0; j < o; ++j) {
+        cy(i, j) = float(sum.hy[i * o + j] / n);
+      }
+    }
+    if (auto f = Cholesky::factor(c)) {
+      f->solve_into(cy);
+    } else if (auto lu = LU::factor(c)) {
+      lu->solve_into(cy);  // semidefinite but not singular after rounding
+    } else {
+      return false;
+    }
+    Matrix& w = net.ws.back();
+    Matrix& b = net.bs.back();
+    w = cy;
+    for (size_t j = 0; j < o; ++j) {
+      double bj = my[j];
+      for (size_t i = 0; i < k; ++i) {
+        bj -= mh[i] * w(i, j);
       }
+      b(0, j) = float(bj);
     }
+    net.round_weights();
+    return true;
   }
-};
 
-struct Batch {
-  size_t begin = 0;
-  float cost = 0.0f;
-  bool finished = false;
+ private:
+  // means and centered co-moments of one shard's rows, and its scratch
+  struct Part {
+    size_t k, o;
+    size_t n = 0;
+    std::vector<double> hh, hy;  // sum (h - mean h)^T (h - mean h), (y ...)
+    std::vector<double> h, y;    // means
+    Workspace work;
+    Matrix hc, yz, g, gy;  // centered chunk, pre-activation targets, GEMMs
+    std::vector<double> ch, cy;  // chunk means
 
-  void process(size_t batch_size, NeuralNetwork& nn, const Matrix& t,
-               float rate) {
-    if (finished) {
-      finished = false;
-      begin = 0;
-      cost = 0.0f;
-    }
+    Part(size_t k, size_t o)
+        : k(k), o(o), hh(k * k), hy(k * o), h(k), y(o), ch(k), cy(o) {}
 
-    size_t size = batch_size;
-    // for when batch_size gets greater than number of samples left
-    if (begin + batch_size >= t.rows) {
-      size = t.rows - begin;
+    void add(const NeuralNetwork& net, MatrixView t) {
+      size_t in = net.arch.front();
+      size_t rows = t.rows;
+      MatrixView x = t.block(0, 0, rows, in);
+      MatrixView hv = x;
+      if (net.ws.size() > 1) {
+        // the output layer runs too, but it is the cheap one
+        work.prepare(net.arch);
+        net.infer_into(x, work.as);
+        hv = work.as[net.ws.size() - 1].view();
+      }
+      yz.resize(rows, o);
+      Activation act = net.acts.back();
+      const float lim = 1.0f - 1e-4f;
+      for (size_t i = 0; i < rows; ++i) {
+        const float* src = t.row(i) + in;
+        float* dst = &yz.data[i * o];
+        for (size_t j = 0; j < o; ++j) {
+          float v = src[j];
+          if (act == Activation::Sigmoid) {
+            v = std::clamp(v, 1.0f - lim, lim);
+            v = std::log(v / (1.0f - v));
+          } else if (act == Activation::Tanh) {
+            v = std::atanh(std::clamp(v, -lim, lim));
+          }
+          dst[j] = v;
+        }
+      }
+      // center the chunk on its own means, so the float GEMMs only see
+      // deviations
+      std::fill(ch.begin(), ch.end(), 0.0);
+      std::fill(cy.begin(), cy.end(), 0.0);
+      for (size_t i = 0; i < rows; ++i) {
+        const float* hr = hv.row(i);
+        for (size_t j = 0; j < k; ++j) {
+          ch[j] += hr[j];
+        }
+        for (size_t j = 0; j < o; ++j) {
+          cy[j] += yz.data[i * o + j];
+        }
+      }
+      for (double& m : ch) {
+        m /= rows;
+      }
+      for (double& m : cy) {
+        m /= rows;
+      }
+      hc.resize(rows, k);
+      for (size_t i = 0; i < rows; ++i) {
+        const float* hr = hv.row(i);
+        for (size_t j = 0; j < k; ++j) {
+          hc.data[i * k + j] = float(hr[j] - ch[j]);
+        }
+        for (size_t j = 0; j < o; ++j) {
+          yz.data[i * o + j] = float(yz.data[i * o + j] - cy[j]);
+        }
+      }
+      g.resize(k, k);
+      gy.resize(k, o);
+      sgemm(Trans::T, Trans::N, k, k, rows, 1.0f, hc.data.data(), k,
+            hc.data.data(), k, 0.0f, g.data.data(), k);
+      sgemm(Trans::T, Trans::N, k, o, rows, 1.0f, hc.data.data(), k,
+            yz.data.data(), o, 0.0f, gy.data.data(), o);
+      merge(rows, ch.data(), cy.data(), g.data.data(), gy.data.data());
     }
 
-    // number of cols remain same coz u know inputs and outpus but we like make
-    // small batchs of rows
-    Matrix batch_t(size, t.cols);
-    for (size_t i = 0; i < size; ++i) {
-      for (size_t j = 0; j < t.cols; ++j) {
-        batch_t(i, j) = t(begin + i, j);
+    // folds in the stats of nb more rows (Chan et al.): co-moments add,
+    // plus the outer product of the mean shift weighted n * nb / (n + nb)
+    template <typename T>
+    void merge(size_t nb, const double* mhb, const double* myb,
+               const T* hhb, const T* hyb) {
+      if (nb == 0) {
+        return;
+      }
+      size_t total = n + nb;
+      double wgt = double(n) * double(nb) / double(total);
+      double share = double(nb) / double(total);
+      for (size_t i = 0; i < k; ++i) {
+        double di = mhb[i] - h[i];
+        for (size_t j = 0; j < k; ++j) {
+          hh[i * k + j] += double(hhb[i * k + j]) + wgt * di * (mhb[j] - h[j]);
+        }
+        for (size_t j = 0; j < o; ++j) {
+          hy[i * o + j] += double(hyb[i * o + j]) + wgt * di * (myb[j] - y[j]);
+        }
       }
+      for (size_t i = 0; i < k; ++i) {
+        h[i] += (mhb[i] - h[i]) * share;
+      }
+      for (size_t j = 0; j < o; ++j) {
+        y[j] += (myb[j] - y[j]) * share;
+      }
+      n = total;
     }
+  };
 
-    NeuralNetwork g = nn.backprop(batch_t);
-    nn.learn(g, rate);
-    cost += nn.cost(batch_t);
-    begin += batch_size;
+  size_t k, o;  // last hidden width, outputs
+  std::vector<Part> parts;
+};
 
-    if (begin >= t.rows) {
-      size_t batch_count = (t.rows + batch_size - 1) / batch_size;
-      cost /= batch_count;
-      finished = true;
-    }
+// Replaces net's output layer with the ridge-regression fit on the rows of
+// t ([inputs | targets]); see OutputLayerFit. False if it cannot be fitted.
+inline bool fit_output_layer(NeuralNetwork& net, MatrixView t,
+                             float l2 = 1e-6f) {
+  OutputLayerFit fit(net);
+  fit.add(net, t);
+  return fit.solve(net, l2);
+}
+
+// the same over every row of a DataSource (rewound first), a block of
+// rows at a time, so the data never has to fit in memory. Also false, with
+// net unchanged, if the source fails part way.
+inline bool fit_output_layer(NeuralNetwork& net, DataSource& source,
+                             float l2 = 1e-6f) {
+  assert(source.cols() == net.arch.front() + net.arch.back());
+  OutputLayerFit fit(net);
+  source.rewind();
+  Matrix block;
+  const size_t rows = NeuralNetwork::kCostBatch * get_num_threads() * 4;
+  while (source.read(block, rows) > 0) {
+    fit.add(net, block);
   }
-};
+  return !source.failed() && fit.solve(net, l2);
+}
 
 }  // namespace nn
+
+// internal helpers, not part of the API
+#undef NN_ALWAYS_INLINE
+#undef NN_UNROLL
+
+// NN_PROFILE_ALLOCS: global operator new / delete that count allocations
+// for nn::prof. Define it in exactly one translation unit.
+#ifdef NN_PROFILE_ALLOCS
+#include <new>
+
+// GCC pairs the replaced operator new with std::free below and warns,
+// even though both sides of the pair are ours
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+  if (!nn::prof::paused()) {
+    ++nn::prof::alloc_count();
+  }
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif